@@ -0,0 +1,52 @@
+"""
+Deposits the Phantom SPH particles onto a regular grid (instead of using them as Lime grid points)
+and writes the model for Lime in sf3dmodels mode.
+"""
+#******************
+#sf3dmodels modules
+#******************
+from sf3dmodels import Model
+import sf3dmodels.utils.units as u
+import sf3dmodels.utils.constants as ct
+import sf3dmodels.rt as rt
+from sf3dmodels.grid import SPHGrid
+#******************
+#External libraries
+#******************
+import numpy as np
+import time
+
+t0 = time.time()
+
+file = './snap_00108.ascii'
+data = np.loadtxt(file) 
+#Quantities in code units: i.e length referred to semi-major axis between stars a0, mass referred to mass of stars, time referred to orbital period between binaries
+
+a0 = 5*u.au
+Ms = 2*u.MSun
+mu = ct.G * 2*Ms #Reduced mass
+P = 2*np.pi*a0**1.5/mu**0.5 #Orbital period
+
+data_gas = data[data[:,12]==1] #Gas particles id=1, others are sinks or swallowed particles
+xyz = data_gas[:,0:3].T * a0
+mass = data_gas[:,3] * Ms
+h = data_gas[:,4] * a0
+vel = data_gas[:,6:9].T * a0/P
+
+#Assumed locally isothermal disc: T = T0 (R/R0)^-q
+R = np.linalg.norm(xyz[0:2], axis=0)
+temp = 30.0 * (np.maximum(R, 1*u.au)/(10*u.au))**-0.5
+
+#*******************************
+#SPH DEPOSITION ON A REGULAR GRID
+#*******************************
+GRID = Model.grid([200*u.au, 200*u.au, 60*u.au], [121, 121, 41], rt_code='lime')
+sph = SPHGrid(GRID, xyz, mass, h)
+prop = sph.deposit(fields={'temp_gas': temp, 'vel_x': vel[0], 'vel_y': vel[1], 'vel_z': vel[2]}, dens_tag='dens_H2')
+prop['temp_dust'] = prop['temp_gas']
+prop['abundance_0'] = np.zeros(GRID.NPoints) + 1e-4
+
+lime = rt.Lime(GRID)
+lime.finalmodel(prop) #Also writes sf3d_manifest.h, read by rt-lime-co-grid.c
+
+print ('Ellapsed time:', time.time()-t0)
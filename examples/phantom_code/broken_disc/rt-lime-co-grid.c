@@ -0,0 +1,128 @@
+/*
+ *  model.c
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  Copyright (C) 2006-2014 Christian Brinch
+ *  Copyright (C) 2015 The LIME development team
+ *
+ */
+
+#include "lime.h"
+#include "sf3d_manifest.h" //Written by grid_sph.py together with datatab.dat
+
+/******************************************************************************/
+
+void
+input(inputPars *par, image *img){
+  int i;
+  /*
+   * Basic parameters. See cheat sheet for details.
+   */
+  par->radius                   = SF3D_RADIUS;   //Sphere enclosing the regular grid
+  par->minScale                 = SF3D_MINSCALE; //Half the cell size
+  par->pIntensity               = SF3D_NCELLS;   //121 x 121 x 41 cells
+  par->sinkPoints               = SF3D_SINKPOINTS; //Cells on the boundary of the sphere
+  par->dust                     = "../../opacities_k05_230GHz_B_1_7.tab";
+  par->moldatfile[0]            = "co.dat";
+  
+  par->antialias                = 1;
+  par->sampling                 = 1; // if 0: log distr. for radius, directions distr. uniformly on a sphere.
+
+  par->lte_only                 = 1;
+  par->gridfile                 = "grid.vtk";
+
+  par->collPartIds[0]           = CP_H2; //Coll part
+
+  /*
+   * Definitions for image #0. Add blocks with successive values of i for additional images.
+   * Each block is ray-traced in a separate pass over the grid: images that only differ in the unit 
+   * should be merged into a single block listing all of them in img[i].units.
+   */  
+
+  //Dust continuum image
+  i=0;
+  img[i].pxls                   = 500;               // Pixels per dimension                                            
+  img[i].imgres                 = 0.00042;           // Resolution in arc seconds                                        
+  img[i].theta                  = 0;            // 0: face-on, pi/2: edge-on                                      
+  img[i].phi                    = 0.;            // Azimuthal angle                                                
+  img[i].distance               = 1000*PC;         // source distance in m                                                
+  img[i].source_vel             = 0;              // source velocity in m/s                                        
+  img[i].units                  = "0,4";          // Kelvin and tau from the same ray-tracing pass, one file per unit
+  img[i].filename               = "img_cont_faceon_band7.fits";
+  img[i].freq                   = 345.7959899e9;         //Continuum central frequency                                     
+
+  //Line image
+  i=1;
+  img[i].trans                   = 2;            //Line transition
+  img[i].molI                   = 0;            //mol ID
+  img[i].pxls                   = 500;               // Pixels per dimension                                            
+  img[i].nchan                  = 81;
+  img[i].velres                 = 100.;
+  img[i].imgres                 = 0.00042;           // Resolution in arc seconds                                        
+  img[i].theta                  = 0;            // 0: face-on, pi/2: edge-on                                      
+  img[i].phi                    = 0.;            // Azimuthal angle                                                
+  img[i].distance               = 1000*PC;         // source distance in m                                                
+  img[i].source_vel             = 0;              // source velocity in m/s                                        
+  img[i].units                  = "0,4";          // Kelvin and tau from the same ray-tracing pass, one file per unit
+  img[i].filename               = "img_CO_J3-2_LTE_faceon.fits";
+
+}
+
+/******************************************************************************/
+
+
+void
+density(double dummy0, double dummy1, double id, double *density){
+  int id_int=round(id);
+  density[0] = sf3d->dens_H2[id_int]; 
+}
+
+/******************************************************************************/
+
+void
+temperature(double dummy0, double dummy1, double id, double *temperature){
+  int id_int=round(id);
+  temperature[0] = sf3d->temp_gas[id_int]; 
+  temperature[1] = sf3d->temp_dust[id_int];
+}
+
+/******************************************************************************/
+
+void
+abundance(double dummy0, double dummy1, double id, double *abundance){
+  int id_int=round(id);
+  abundance[0] = sf3d->abundance[0][id_int];
+}
+
+/******************************************************************************/
+
+void
+gasIIdust(double dummy0, double dummy1, double id, double *gtd){
+  int id_int=round(id);
+  *gtd = 100;
+}
+
+/******************************************************************************/
+
+void
+doppler(double dummy0, double dummy1, double id, double *doppler){
+  /*
+   * 200 m/s as the doppler b-parameter. This
+   * can be a function of (x,y,z) as well.
+   * Note that *doppler is a pointer, not an array.
+   * Remember the * in front of doppler.
+   */
+  *doppler = 10.;
+}
+
+/******************************************************************************/
+
+void
+velocity(double dummy0, double dummy1, double id, double *vel){
+  int id_int=round(id);
+  vel[0] = sf3d->vel_x[id_int];
+  vel[1] = sf3d->vel_y[id_int];
+  vel[2] = sf3d->vel_z[id_int]; 
+}
+
+/******************************************************************************/
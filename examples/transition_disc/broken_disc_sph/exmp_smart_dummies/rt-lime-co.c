@@ -8,6 +8,7 @@
  */
 
 #include "lime.h"
+#include "sf3d_manifest.h" //Written by sf3dmodels together with datatab.dat
 
 /******************************************************************************/
 
@@ -17,10 +18,10 @@ input(inputPars *par, image *img){
   /*
    * Basic parameters. See cheat sheet for details.
    */
-  par->radius                   = 100*AU;
-  par->minScale                 = 0.1*AU; // 2 * sizex / Nx / 2
-  par->pIntensity               = 246181;
-  par->sinkPoints               = 50000; 
+  par->radius                   = SF3D_RADIUS;     //Sphere enclosing the cells and dummies
+  par->minScale                 = SF3D_MINSCALE;   //Half the smallest cell spacing
+  par->pIntensity               = SF3D_NCELLS;     //Rows in datatab.dat
+  par->sinkPoints               = SF3D_SINKPOINTS; //Larger of the boundary cells and the dummies
   par->dust                     = "../../../opacities_k05_230GHz_B_1_7.tab";
   par->moldatfile[0]            = "co.dat";
   par->moldatfile[1]            = "ch3cn.dat";
@@ -48,6 +49,8 @@ input(inputPars *par, image *img){
 
   /*
    * Definitions for image #0. Add blocks with successive values of i for additional images.
+   * Each block is ray-traced in a separate pass over the grid: images that only differ in the unit 
+   * should be merged into a single block listing all of them in img[i].units (see image #0).
    */  
 
   /*
@@ -59,7 +62,7 @@ input(inputPars *par, image *img){
   img[i].phi                    = 0.;            // Azimuthal angle                                                
   img[i].distance               = 1000*PC;         // source distance in m                                                
   img[i].source_vel             = 0;              // source velocity in m/s                                        
-  img[i].unit                   = 0;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
+  img[i].units                  = "0,4";          // Kelvin and tau from the same ray-tracing pass, one file per unit
   img[i].filename               = "img_T150_cont_faceon_band7.fits";
   img[i].freq                   = 345.7959899e9;         //Continuum central frequency                                     
 
@@ -122,18 +125,6 @@ input(inputPars *par, image *img){
   img[i].unit                   = 0;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
   img[i].filename               = "img_T150_cont_edgeon_phi90_band6.fits";
   img[i].freq                   = 230.0e9;         //Continuum central frequency                                     
-  
-  //Dust continuum image
-  i=6;
-  img[i].pxls                   = 500;               // Pixels per dimension                                            
-  img[i].imgres                 = 0.00042;           // Resolution in arc seconds                                        
-  img[i].theta                  = 0;            // 0: face-on, pi/2: edge-on                                      
-  img[i].phi                    = 0.;            // Azimuthal angle                                                
-  img[i].distance               = 1000*PC;         // source distance in m                                                
-  img[i].source_vel             = 0;              // source velocity in m/s                                        
-  img[i].unit                   = 4;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
-  img[i].filename               = "img_T150_cont_faceon_band7_tau.fits";
-  img[i].freq                   = 345.7959899e9;         //Continuum central frequency                                     
   */
   
   /*
@@ -222,8 +213,8 @@ input(inputPars *par, image *img){
   img[i].phi                    = 0.;            // Azimuthal angle                                                
   img[i].distance               = 1000*PC;         // source distance in m                                                
   img[i].source_vel             = 0;              // source velocity in m/s                                        
-  img[i].unit                   = 0;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
-  img[i].filename               = "img_T150_CO_J3-2_LTE_kelvin_faceon.fits";
+  img[i].units                  = "0,4";          // Kelvin and tau from the same ray-tracing pass, one file per unit
+  img[i].filename               = "img_T150_CO_J3-2_LTE_faceon.fits";
   
 //Line image
   i=1;
@@ -254,21 +245,6 @@ input(inputPars *par, image *img){
   img[i].source_vel             = 0;              // source velocity in m/s                                        
   img[i].unit                   = 0;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
   img[i].filename               = "img_T150_CO_J3-2_LTE_kelvin_edgeon_phi90.fits";
-
-  //Line image
-  i=3;
-  img[i].trans                   = 2;            //Line transition
-  img[i].molI                   = 0;            //mol ID
-  img[i].pxls                   = 500;               // Pixels per dimension                                            
-  img[i].nchan                  = 81;
-  img[i].velres                 = 100.;
-  img[i].imgres                 = 0.00042;           // Resolution in arc seconds                                        
-  img[i].theta                  = 0;            // 0: face-on, pi/2: edge-on                                      
-  img[i].phi                    = 0.;            // Azimuthal angle                                                
-  img[i].distance               = 1000*PC;         // source distance in m                                                
-  img[i].source_vel             = 0;              // source velocity in m/s                                        
-  img[i].unit                   = 4;              // 0:Kelvin 1:Jansky/pixel 2:SI 3:Lsun/pixel 4:tau                      
-  img[i].filename               = "img_T150_CO_J3-2_LTE_tau_faceon.fits";
  
 }
 
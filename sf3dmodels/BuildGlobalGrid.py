@@ -7,6 +7,7 @@ import time
 
 from . import Model
 from . import Utils as U
+from .utils import trace
 
 #------------------------------
 #FINDING NEAREST NEIGHBOR 
@@ -28,11 +29,12 @@ def mindistance(x,xma,Nx):
 #------------------------------
 #OVERLAPING SUBMODELS INTO GRID
 #------------------------------
+@trace.stage
 def overlap(GRID, submodels = [''], folder = './Subgrids/', 
             T_min = 30., rho_min = 1.e9,
             all = False, radmc3d = False):
             
-    func_name = inspect.stack()[0][3]
+    func_name = inspect.currentframe().f_code.co_name
 
     if folder[-1] != '/': folder = folder + '/'
     t0 = time.time()
@@ -7,6 +7,7 @@ import sys
 import os
 
 from .Utils import *
+from .utils import trace
 
 class Struct:
     def __init__(self, **entries):
@@ -16,6 +17,7 @@ class Struct:
 #SPATIAL (Spherical-)GRID
 #------------------------
  
+@trace.stage
 def grid(XYZmax, NP, rt_code = 'lime', include_zero = True, indexing='ij'):
     """
     Computes the hosting grid for the model(s).
@@ -135,7 +137,7 @@ def grid(XYZmax, NP, rt_code = 'lime', include_zero = True, indexing='ij'):
     
 
     print ('Number of grid nodes for x,y,z:', NP)
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
     
     return Struct( **{'XYZgrid': XYZgrid, 'XYZcentres': XYZcentres, 
@@ -285,6 +287,7 @@ def streamline(Rd, GRID):
 #DENSITY FUNCTION
 #-------------------
 
+@trace.stage
 def density_Env_Disc(RStar, Rd, rhoE0, Arho, GRID, 
                      discFlag = True, envFlag = False, 
                      rdisc_max = False, renv_max = False, 
@@ -353,7 +356,7 @@ def density_Env_Disc(RStar, Rd, rhoE0, Arho, GRID,
     RHO = rhoDISC + rhoENV 
 
     nonzero_ids = np.where(RHO != 0.0)
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': RHO, 'disc': rhoDISC, 'env': rhoENV, 'discFlag': discFlag, 'envFlag': envFlag, 
@@ -367,6 +370,7 @@ def density_Env_Disc(RStar, Rd, rhoE0, Arho, GRID,
 #DENSITY (Hamburguers) FUNCTION
 #------------------------------
 
+@trace.stage
 def density_Hamburgers(RStar, shFactor, Ro, rhoE0, Arho, GRID, 
                        p = 2.25, q = 0.5, rho_thres = 10.0, rho_min = 1.0, 
                        Rt = False, discFlag=True, rdisc_max = False):
@@ -416,7 +420,7 @@ def density_Hamburgers(RStar, shFactor, Ro, rhoE0, Arho, GRID,
     nonzero_ids = np.where(rhoDISC != 0.0)
     #rhoDISC[GRID.R_ind_zero] = 0 #*np.mean(rhoDISC)
     
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoDISC, 'disc': rhoDISC, 'env': 0., 'H': H,  
@@ -428,6 +432,7 @@ def density_Hamburgers(RStar, shFactor, Ro, rhoE0, Arho, GRID,
 #DENSITY (Hamburguers - piecewise) FUNCTION
 #------------------------------------------
 
+@trace.stage
 def density_Hamburgers_piecewise(RStar, H0, R_list, p_list, rho0, GRID, RH_list = None,
                                  q_list = [0.5], rho_thres = 10.0, rho_min = 0.0, 
                                  Rt = False):
@@ -493,7 +498,7 @@ def density_Hamburgers_piecewise(RStar, H0, R_list, p_list, rho0, GRID, RH_list
     nonzero_ids = np.where(rhoDISC != 0.0)
     #rhoDISC[GRID.R_ind_zero] = 0 #*np.mean(rhoDISC)
     
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoDISC, 'disc': rhoDISC, 'env': 0., 'H': H,  
@@ -505,6 +510,7 @@ def density_Hamburgers_piecewise(RStar, H0, R_list, p_list, rho0, GRID, RH_list
 #DENSITY (PowerLaw-mean_rho) FUNCTION
 #-----------------------------------
 
+@trace.stage
 def density_Powerlaw(r_max, rho_mean, q, GRID, rho_min = 1.0e3):
 
 #r_max: Maximum radius of the envelope 
@@ -536,7 +542,7 @@ def density_Powerlaw(r_max, rho_mean, q, GRID, rho_min = 1.0e3):
     
     nonzero_ids = np.where(rhoENV != 0.0)
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoENV, 'disc': np.zeros(NPoints), 'env': rhoENV, 
@@ -550,6 +556,7 @@ def density_Powerlaw(r_max, rho_mean, q, GRID, rho_min = 1.0e3):
 #DENSITY (PowerLaw-standard) FUNCTION
 #------------------------------------
 
+@trace.stage
 def density_Powerlaw2(r_max, r_min, rho0, q, GRID, rho_min = 1.0e3):
 
 #r_max: Maximum radius of the envelope 
@@ -577,7 +584,7 @@ def density_Powerlaw2(r_max, r_min, rho0, q, GRID, rho_min = 1.0e3):
     
     nonzero_ids = np.where(rhoENV != 0.0)
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoENV, 'disc': np.zeros(NPoints), 'env': rhoENV, 
@@ -591,6 +598,7 @@ def density_Powerlaw2(r_max, r_min, rho0, q, GRID, rho_min = 1.0e3):
 #DENSITY (PowerLaw-Shells) FUNCTION
 #------------------------------------
 
+@trace.stage
 def density_PowerlawShells(r_list, p_list, rho0, GRID, rho_min = 1.0e3):
 
 #r_list: List of shells' limits, length (n,)
@@ -624,7 +632,7 @@ def density_PowerlawShells(r_list, p_list, rho0, GRID, rho_min = 1.0e3):
     #------------------------
     #------------------------
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoENV, 'disc': np.zeros(NPoints), 'env': rhoENV, 
@@ -638,6 +646,7 @@ def density_PowerlawShells(r_list, p_list, rho0, GRID, rho_min = 1.0e3):
 #DENSITY (Keto2003, HCH_II) FUNCTION
 #-----------------------------------
 
+@trace.stage
 def density_Keto_HII(MStar, r_min, r_max, rho_s, T, GRID, q = 1.5):
 
 #r_min: Minimum radius of the envelope (must be > 0)
@@ -676,7 +685,7 @@ def density_Keto_HII(MStar, r_min, r_max, rho_s, T, GRID, q = 1.5):
 
     nonzero_ids = np.where(rhoENV != 0.0)
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoENV, 'disc': np.zeros(NPoints), 'env': rhoENV, 
@@ -691,6 +700,7 @@ def density_Keto_HII(MStar, r_min, r_max, rho_s, T, GRID, q = 1.5):
 #DENSITY (PowerLaw, HCH_II) FUNCTION
 #-----------------------------------
 
+@trace.stage
 def density_Powerlaw_HII(r_min, r_max, r_s, rho_s, q, GRID):
 
 #r_min: Minimum radius of the envelope (must be > 0)
@@ -715,7 +725,7 @@ def density_Powerlaw_HII(r_min, r_max, r_s, rho_s, q, GRID):
 
     nonzero_ids = np.where(rhoENV != 0.0)
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': rhoENV, 'disc': np.zeros(NPoints), 'env': rhoENV, 
@@ -729,6 +739,7 @@ def density_Powerlaw_HII(r_min, r_max, r_s, rho_s, q, GRID):
 #DENSITY (Constant) FUNCTION
 #---------------------------
 
+@trace.stage
 def density_Constant(Rd, GRID, discDens = 0, rdisc_max = False, envDens = 0, renv_max = False):
 
     rRTP = GRID.rRTP
@@ -766,7 +777,7 @@ def density_Constant(Rd, GRID, discDens = 0, rdisc_max = False, envDens = 0, ren
         
     nonzero_ids = np.where(RHO != 0.0)
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': RHO, 'disc': rhoDISC, 'env': rhoENV, 
@@ -886,6 +897,7 @@ def gastodust(val, NPoints):
 #TEMPERATURE FUNCTION
 #----------------------
 
+@trace.stage
 def temperature(TStar, Rd, T10Env, RStar, MStar, MRate, BT, density, GRID, 
                 Tmin_disc = 30., Tmin_env = 30., p = 0.33, ang_cavity = False):
 
@@ -947,7 +959,7 @@ def temperature(TStar, Rd, T10Env, RStar, MStar, MRate, BT, density, GRID,
     #Weighted temperature with density 
     TEMP = (tempDISC * rhoDISC + tempENV * rhoENV) / density.total
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TEMP, 'disc': tempDISC, 'env': tempENV, 'discFlag': density.discFlag, 'envFlag': density.envFlag} )
@@ -959,6 +971,7 @@ def temperature(TStar, Rd, T10Env, RStar, MStar, MRate, BT, density, GRID,
 #TEMPERATURE (Hamburgers) FUNCTION
 #---------------------------------
 
+@trace.stage
 def temperature_Hamburgers(TStar, RStar, MStar, MRate, Rd, T10Env, BT, density, GRID, 
                            p = 0.33, Tmin_disc = 30., Tmin_env = 30., inverted = False):
 
@@ -1027,7 +1040,7 @@ def temperature_Hamburgers(TStar, RStar, MStar, MRate, Rd, T10Env, BT, density,
     #Weighted temperature with density 
     TEMP = (tempDISC * rhoDISC + tempENV * rhoENV) / density.total
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TEMP, 'disc': tempDISC, 'env': tempENV, 'discFlag': density.discFlag, 'envFlag': density.envFlag} )
@@ -1039,6 +1052,7 @@ def temperature_Hamburgers(TStar, RStar, MStar, MRate, Rd, T10Env, BT, density,
 #TEMPERATURE (Constant) FUNCTION
 #-------------------------------
 
+@trace.stage
 def temperature_Constant(density, GRID, discTemp = 0, envTemp = 0, backTemp = 30.0):
 
     rRTP = GRID.rRTP
@@ -1080,7 +1094,7 @@ def temperature_Constant(density, GRID, discTemp = 0, envTemp = 0, backTemp = 30
     
     #TEMP = np.choose(zerodens_mask, ((tempDISC * rhoDISC + tempENV * rhoENV) / density.total, backTemp))
         
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TEMP, 'disc': tempDISC, 'env': tempENV, 'discFlag': bool(discTemp), 'envFlag': bool(envTemp)} )
@@ -1092,6 +1106,7 @@ def temperature_Constant(density, GRID, discTemp = 0, envTemp = 0, backTemp = 30
 #TEMPERATURE (PowerLaw-mean_rho) FUNCTION
 #-----------------------------------
 
+@trace.stage
 def temperature_Powerlaw(r_max, T_mean, q, GRID, T_min = 2.725):
 
 #r_max: Maximum radius of the envelope 
@@ -1121,7 +1136,7 @@ def temperature_Powerlaw(r_max, T_mean, q, GRID, T_min = 2.725):
     #------------------------
     #------------------------
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TENV, 'disc': np.zeros(NPoints), 'env': TENV, 
@@ -1135,6 +1150,7 @@ def temperature_Powerlaw(r_max, T_mean, q, GRID, T_min = 2.725):
 #TEMPERATURE (PowerLaw-standard) FUNCTION
 #-----------------------------------------
 
+@trace.stage
 def temperature_Powerlaw2(r_max, r_min, T0, q, GRID, T_min = 2.725):
 
 #r_max: Maximum radius of the envelope 
@@ -1160,7 +1176,7 @@ def temperature_Powerlaw2(r_max, r_min, T0, q, GRID, T_min = 2.725):
     #------------------------
     #------------------------
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TENV, 'disc': np.zeros(NPoints), 'env': TENV, 
@@ -1174,6 +1190,7 @@ def temperature_Powerlaw2(r_max, r_min, T0, q, GRID, T_min = 2.725):
 #TEMPERATURE (PowerLaw-Shells) FUNCTION
 #------------------------------------
 
+@trace.stage
 def temperature_PowerlawShells(r_list, p_list, T0, GRID, T_min = 1.0e3):
 
 #r_list: List of shells' limits, length (n,)
@@ -1207,7 +1224,7 @@ def temperature_PowerlawShells(r_list, p_list, T0, GRID, T_min = 1.0e3):
     #------------------------
     #------------------------
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'total': TENV, 'disc': np.zeros(NPoints), 'env': TENV, 
@@ -1221,6 +1238,7 @@ def temperature_PowerlawShells(r_list, p_list, T0, GRID, T_min = 1.0e3):
 #VELOCITY FUNCTION
 #----------------------
 
+@trace.stage
 def velocity(RStar,MStar,Rd,density,GRID):
 
 #MStar: Mass of the central source
@@ -1294,7 +1312,7 @@ def velocity(RStar,MStar,Rd,density,GRID):
 
     #----------------------------------------------
     #----------------------------------------------
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'x': vx, 'y': vy, 'z': vz} )
@@ -1303,6 +1321,7 @@ def velocity(RStar,MStar,Rd,density,GRID):
 #----------------------
 #----------------------
 
+@trace.stage
 def velocity_piecewise(density, GRID, 
                        R_list=None, pR_list=None, v0R=None, #Polar piecewise
                        r_list=None, pr_list=None, v0r=None  #Radial piecewise
@@ -1375,7 +1394,7 @@ def velocity_piecewise(density, GRID,
     #------------------------
     #------------------------
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'x': vx, 'y': vy, 'z': vz} )
@@ -1386,6 +1405,7 @@ def velocity_piecewise(density, GRID,
 #VELOCITY (Random) FUNCTION
 #--------------------------
 
+@trace.stage
 def velocity_random(v_disp,NPoints):
 
     print ('Computing random (uniform) velocities...')
@@ -1395,7 +1415,7 @@ def velocity_random(v_disp,NPoints):
     v_y = v_disp * (2 * np.random.random(NPoints) - 1)  
     v_z = v_disp * (2 * np.random.random(NPoints) - 1)  
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'x': v_x, 'y': v_y, 'z': v_z} )
@@ -1406,6 +1426,7 @@ def velocity_random(v_disp,NPoints):
 #See eq. (4)
 #-------------------------------
 
+@trace.stage
 def velocity_infall(dens_dict, ff_factor, MStar, r_stellar, GRID, v0 = [0.,0.,0.]):
 
 #dens_dict: dictionary containing the density distributions to compute the enclosed mass from
@@ -1448,7 +1469,7 @@ def velocity_infall(dens_dict, ff_factor, MStar, r_stellar, GRID, v0 = [0.,0.,0.
     v_y = foo*GRID.XYZ[1]
     v_z = foo*GRID.XYZ[2]
 
-    print ('%s is done!'%inspect.stack()[0][3])
+    print ('%s is done!'%inspect.currentframe().f_code.co_name)
     print ('-------------------------------------------------\n-------------------------------------------------')
 
     return Struct( **{'x': v_x, 'y': v_y, 'z': v_z} )
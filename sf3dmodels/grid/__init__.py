@@ -35,12 +35,20 @@ if not _ASTROPY_SETUP_:
     # For egg_info test builds to pass, put package imports here.
     #from .example_mod import *
 
-    from . import fillgrid
+    from . import fillgrid, curves
+    from .deposit import Deposit
+    from .sph import SPHGrid
+    from .index import SubmodelIndex
+    from .kdtree import CellTree
     from .core import Grid, Overlap, RandomGridAroundAxis, Build_r, Build_theta, Build_phi, NeighbourRegularGrid
     
 __all__ = ['Grid',
            'NeighbourRegularGrid',
            'Overlap',
+           'SubmodelIndex',
+           'CellTree',
+           'Deposit',
+           'SPHGrid',
            'RandomGridAroundAxis',
            'Build_r', 'Build_theta', 'Build_phi',
            'GridSet'] 
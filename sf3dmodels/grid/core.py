@@ -2,6 +2,7 @@ from __future__ import print_function
 import os
 import time
 import copy
+import hashlib
 import inspect
 import itertools
 import numpy as np
@@ -12,6 +13,8 @@ from ..utils.constants import temp_cmb
 from ..utils.prop import propTags
 from ..tools import formatter
 from .. import Model
+from .index import SubmodelIndex
+from ..utils import trace
 
 #****************
 #MAKE GRID (Included: Random)
@@ -67,11 +70,11 @@ class NeighbourRegularGrid(object):
     """
     def _get_nearest_id_lime(self,i_list,j_list,k_list,ns):
         nx,ny,nz = ns
-        return np.array(i_list)*ny*nz + np.array(j_list)*nz + np.array(k_list)
+        return np.array(i_list, dtype=int)*ny*nz + np.array(j_list, dtype=int)*nz + np.array(k_list, dtype=int)
 
     def _get_nearest_id_radmc3d(self,i_list,j_list,k_list,ns):
         nx,ny,nz = ns
-        return np.array(k_list)*ny*nx + np.array(j_list)*nx + np.array(i_list) 
+        return np.array(k_list, dtype=int)*ny*nx + np.array(j_list, dtype=int)*nx + np.array(i_list, dtype=int) 
 
     def _neighbour1d(self,x,xma,Nx):
         """
@@ -117,11 +120,122 @@ class Overlap(NeighbourRegularGrid):
         allfiles=os.popen("ls -1 %s*.dat"%folder).read().split('\n',num)[:-1]
         return allfiles
 
+    def _get_domain(self):
+        """
+        Returns the lower and upper corners of the region covered by the cells of GRID.
+        """
+        lo, hi = np.zeros(3), np.zeros(3)
+        for i, xc in enumerate(self.GRID.XYZcentres):
+            half = 0.5*(xc[1]-xc[0]) if len(xc) > 1 else 0.0
+            lo[i], hi[i] = xc[0]-half, xc[-1]+half
+        return lo, hi
+
+    def _read_indexed(self, file, columns):
+        """
+        Reads from file only the chunks and rows that fall within the domain of GRID, via the file's sidecar index.
+        """
+        xyz_cols = [list(columns).index(coord) for coord in ['x','y','z']]
+        lo, hi = self._get_domain()
+        index = SubmodelIndex.get(file, xyz_cols=xyz_cols)
+        if index.bbox is None: 
+            print ('Spatial index for %s: the file has no rows, skipping it.'%file)
+            return np.empty((0, len(columns)))
+        chunk_ids = index.select(lo, hi)
+        data = index.read(chunk_ids, len(columns))
+        inside = np.logical_and(data[:,xyz_cols] >= lo, data[:,xyz_cols] <= hi).all(axis=1)
+        print ('Spatial index for %s: reading %d/%d chunks, %d rows within the grid domain.'
+               %(file, len(chunk_ids), len(index.chunks), np.sum(inside)))
+        return data[inside]
+
+    def _get_file_hash(self, file):
+        """
+        Returns the sha1 hash of the content of file.
+        """
+        sha = hashlib.sha1()
+        with open(file, 'rb') as f:
+            for block in iter(lambda: f.read(1 << 20), b''): sha.update(block)
+        return sha.hexdigest()
+
+    def _get_setup_hash(self, columns, weighting_dens, rt_code, index, deposit='nearest', kwargs_deposit={}):
+        """
+        Returns a short hash of the settings that determine the per-file partial sums.
+        """
+        sha = hashlib.sha1()
+        for val in [list(columns), weighting_dens, rt_code, bool(index), list(self.GRID.Nodes)]: sha.update(str(val).encode())
+        if deposit != 'nearest': sha.update(str([deposit, sorted(kwargs_deposit.items())]).encode())
+        for xc in self.GRID.XYZcentres: sha.update(np.ascontiguousarray(xc, dtype=float).tobytes())
+        return sha.hexdigest()[:16]
+
+    def _bin_file(self, file, columns, densities, weighted, weighting_dens, get_id, index=False, deposit='nearest', kwargs_deposit={}):
+        """
+        Assigns each row of a submodel file to its nearest GRID node.
+
+        Returns a dict with the touched cell ids ('cells'), the number of rows per touched cell ('counts'), 
+        and the per-cell sums of each density column and of each ``weighted`` column multiplied by the weighting density.
+
+        If ``deposit`` is 'cic' or 'sph' the rows are deposited instead onto the neighbouring cells with `~sf3dmodels.grid.Deposit`. 
+        In that case the returned sums are already deposited densities (mass per cell volume) and 'counts' is set to one.
+        """
+        if index: data = self._read_indexed(file, columns)
+        else: data = np.loadtxt(file, dtype=None, ndmin=2)
+        data_dict = {columns[i]: data[:,i] for i in range(len(columns))}
+        nrows = len(data)
+
+        if weighting_dens == 'dens_mass': 
+            data_dict[weighting_dens] = np.zeros(nrows)
+            for col in densities:
+                if col != weighting_dens: data_dict[weighting_dens] += data_dict[col] * propTags.get_dens_mass(col)
+
+        if deposit != 'nearest': return self._deposit_file(file, data_dict, densities, weighted, weighting_dens, deposit, **kwargs_deposit)
+
+        nx, ny, nz = self.GRID.Nodes
+        xgrid, ygrid, zgrid = self.GRID.XYZcentres 
+        i_list, j_list, k_list = [], [], []
+        xiter = iter(data_dict['x'])
+        yiter = iter(data_dict['y'])
+        ziter = iter(data_dict['z'])
+        for _ in itertools.repeat(None, nrows): 
+            i_list.append(self._neighbour1d(next(xiter),xgrid,nx))
+            j_list.append(self._neighbour1d(next(yiter),ygrid,ny))
+            k_list.append(self._neighbour1d(next(ziter),zgrid,nz))
+        num = get_id(i_list,j_list,k_list,self.GRID.Nodes)
+
+        cells, inverse, counts = np.unique(num, return_inverse=True, return_counts=True)
+        ncells = len(cells)
+        partial = {'cells': cells, 'counts': counts}
+        for col in densities: partial[col] = np.bincount(inverse, weights=data_dict[col], minlength=ncells)
+        for col in weighted: partial[col] = np.bincount(inverse, weights=data_dict[col]*data_dict[weighting_dens], minlength=ncells)
+        print ('Finished binning for: %s'%file)
+        return partial
+
+    def _deposit_file(self, file, data_dict, densities, weighted, weighting_dens, kernel, k=32, nthreads=None):
+        """
+        Mass-conserving version of _bin_file. The volume and smoothing length of each row are estimated from its k nearest neighbours.
+        """
+        from .deposit import Deposit
+        dep = Deposit(self.GRID, rt_code=self._rt_code, nthreads=nthreads)
+        xyz = np.array([data_dict['x'], data_dict['y'], data_dict['z']]).T
+        volume, h = dep.knn_volumes(xyz, k=k)
+        cells, ids, w = dep.weights(xyz, kernel=kernel, h=h)
+        cells_u, inverse = np.unique(cells, return_inverse=True)
+        ncells = len(cells_u)
+        wv = w * volume[ids] / dep.cell_volume
+        partial = {'cells': cells_u, 'counts': np.ones(ncells)}
+        for col in densities: partial[col] = np.bincount(inverse, weights=wv*data_dict[col][ids], minlength=ncells)
+        for col in weighted: partial[col] = np.bincount(inverse, weights=wv*(data_dict[col]*data_dict[weighting_dens])[ids], minlength=ncells)
+        print ("Finished '%s' deposition for: %s"%(kernel, file))
+        return partial
+
+    @trace.stage
     def fromfiles(self, columns, 
                   submodels = 'all',
                   weighting_dens = 'all', 
                   rt_code = 'lime',
-                  folder = './Subgrids'): 
+                  folder = './Subgrids',
+                  index = False,
+                  cache = None,
+                  deposit = 'nearest',
+                  kwargs_deposit = {}): 
                   #weighting_dens = {'Lime': ['dens_H', 'dens_H2'],
                   #                  'Radmc3d': ['dens_ion']}):
         """
@@ -149,6 +263,33 @@ class Overlap(NeighbourRegularGrid):
         folder : str, optional
            Folder name were the submodel files are located. Defaults to './Subgrids'.
 
+        index : bool, optional
+           If True, reads the submodel files through their sidecar spatial index (see `~sf3dmodels.grid.SubmodelIndex`), 
+           which is built and written next to the file if missing or outdated. Files and chunks of rows lying outside the ``GRID`` domain are not read, 
+           and rows outside the domain are discarded instead of being assigned to the nearest border cell.\n
+           Useful to re-grid a zoomed-in region of a large set of submodels. Defaults to False.
+
+        cache : str, optional
+           Folder where the partial sums of each submodel are stored: the cells touched by the submodel, the number of rows per cell, 
+           and the per-cell sums of densities and of density-weighted properties. Cached partial sums are keyed by the content hash of the submodel file 
+           and by the merging setup (``GRID``, ``columns``, ``weighting_dens``, ``rt_code``, ``index``). Hence, when a few submodels change
+           only those are binned again, and the output is re-derived from the cached partial sums of the remaining ones.\n
+           Defaults to None: no caching.
+
+        deposit : {'nearest', 'cic', 'sph'}, optional
+           Scheme to bin the submodel rows into the ``GRID`` cells.\n
+           If 'nearest': each row is assigned to its nearest node, and the densities of the rows landing on the same node are averaged.\n
+           If 'cic' or 'sph': mass-conserving deposition. Each row is taken as a parcel of mass (density times the volume of the row, 
+           estimated from the distance to its ``k``-th nearest neighbour in the submodel) spread over the neighbouring cells with cloud-in-cell 
+           or cubic-spline SPH kernel weights, see `~sf3dmodels.grid.Deposit`. The mass of each submodel is preserved and 
+           much sparser submodels can be merged without leaving empty cells. Note that the volume of the rows on the outer boundary
+           of a submodel is overestimated, which slightly increases its deposited mass.\n
+           Defaults to 'nearest'.
+
+        kwargs_deposit : dict, optional
+           Keyword arguments for the 'cic' and 'sph' schemes: 'k', number of neighbours to estimate the volume of each row (defaults to 32), 
+           and 'nthreads', number of threads of the deposition kernel (defaults to the number of cpus).
+
         Returns
         -------
         final_dict : dict
@@ -166,9 +307,9 @@ class Overlap(NeighbourRegularGrid):
         """
 
         #***************************
-        #PREPARING AND READING FILES
+        #PREPARING FILES
         #***************************
-        func_name = inspect.stack()[0][3]
+        func_name = inspect.currentframe().f_code.co_name
         print ("Running function '%s'..."%func_name)
 
         if folder[-1] != '/': folder += '/'
@@ -177,8 +318,6 @@ class Overlap(NeighbourRegularGrid):
         elif isinstance(submodels, list) or isinstance(submodels, np.ndarray): files = [folder + sub for sub in submodels]
         else: raise TypeError("Invalid type: %s for 'submodels'. Please provide a valid 'submodels' object: list, np.ndarray or str 'all'"%type(submodels))
         
-        #If wish to preserve data types and formats use np.genfromtxt, but it's slower and the output is a 1-D array of tuples, where each tuple is a row from the table. 
-        data = [np.loadtxt(file, dtype=None) for file in files] 
         detected = [file.split(folder)[1] for file in allfiles]
         read = [file.split(folder)[1] for file in files]
         
@@ -186,8 +325,7 @@ class Overlap(NeighbourRegularGrid):
         print ('Files detected (%d):'%len(allfiles), detected, 
                '\nFiles to merge in grid (%d):'%nfiles, read)
 
-        data_dicts = [{columns[i]: data[j][:,i] for i in range(len(columns))} for j in range(nfiles)]
-
+        file_columns = columns
         if weighting_dens == 'all': 
             weighting_dens = 'dens_mass'
             columns = np.append(columns,weighting_dens)
@@ -198,9 +336,6 @@ class Overlap(NeighbourRegularGrid):
         #***************************        
         GRID = self.GRID
         ntotal = GRID.NPoints
-        nrows = [len(data[nf]) for nf in range(nfiles)]
-        nx, ny, nz = GRID.Nodes
-        xgrid, ygrid, zgrid = GRID.XYZcentres 
         cm3_to_m3 = 1e6
         
         coords, densities, velocities, others = [], [], [], []
@@ -211,76 +346,59 @@ class Overlap(NeighbourRegularGrid):
             elif kind == 'velocity': velocities.append(col)
             else: others.append(col)
 
-        tmp_dict = {}
-        val0_dict = {}
+        #Base value of each column on cells not touched by a submodel.
+        # The offset on the weighting density avoids zero divisions on empty cells when computing the weighted properties.
+        val0_dict = {col: 0 for col in densities+velocities+others}
+        if weighting_dens == 'dens_mass': val0_dict[weighting_dens] += -1*amu
+        else: val0_dict[weighting_dens] += -1
         
-        for col in densities+others:
-            tmp_dict[col] = np.zeros(ntotal)
-            val0_dict[col] = 0            
-        for col in velocities:
-            tmp_dict[col] = np.zeros(ntotal) #np.random.normal(scale=10*amu,size=ntotal)
-            val0_dict[col] = 0
-
-        if weighting_dens == 'dens_mass': 
-            for nf in range(nfiles):
-                data_dicts[nf][weighting_dens] = np.zeros(nrows[nf])
-                for col in densities:
-                    if col != weighting_dens: data_dicts[nf][weighting_dens] += data_dicts[nf][col] * propTags.get_dens_mass(col)
-    
-            tmp_dict[weighting_dens] += -1*amu
-            val0_dict[weighting_dens] += -1*amu
-        
-        else:
-            tmp_dict[weighting_dens] += -1
-            val0_dict[weighting_dens] += -1
-        
-        partial_dicts = [copy.deepcopy(tmp_dict) for _ in range(nfiles)]
-
-        #***************************
-        #FILLING EACH FILE's DICT 
-        #***************************
-        others_tmp_dicts = [{col: data_dicts[j][col] * data_dicts[j][weighting_dens] for col in velocities+others} for j in range(nfiles)]
-        num_list = [] 
-        num_uniques = []
         if rt_code == 'lime': get_id = self._get_nearest_id_lime
         elif rt_code == 'radmc3d': get_id = self._get_nearest_id_radmc3d
         else: raise ValueError("The value '%s' in rt_code is invalid. Please choose amongst the following: 'lime', 'radmc3d'"%rt_code)
-        for nf in range(nfiles): 
-            i_list, j_list, k_list = [], [], []
-            xiter = iter(data_dicts[nf]['x'])
-            yiter = iter(data_dicts[nf]['y'])
-            ziter = iter(data_dicts[nf]['z'])
-            for _ in itertools.repeat(None, nrows[nf]): 
-                i_list.append(self._neighbour1d(next(xiter),xgrid,nx))
-                j_list.append(self._neighbour1d(next(yiter),ygrid,ny))
-                k_list.append(self._neighbour1d(next(ziter),zgrid,nz))
-            num_list.append(get_id(i_list,j_list,k_list,GRID.Nodes))
-            num_uniques.append(np.unique(num_list[nf], return_counts=True))
-
+        if deposit not in ['nearest', 'cic', 'sph']: raise ValueError("The value '%s' in deposit is invalid. Please choose amongst the following: 'nearest', 'cic', 'sph'"%deposit)
+        self._rt_code = rt_code
+
+        #*******************************************
+        #BINNING EACH FILE (OR READING IT FROM CACHE)
+        #*******************************************
+        if cache is not None:
+            if cache[-1] != '/': cache += '/'
+            if not os.path.isdir(cache): os.makedirs(cache)
+            setup_hash = self._get_setup_hash(columns, weighting_dens, rt_code, index, deposit, kwargs_deposit)
+
+        sparse_partials = []
         for nf in range(nfiles):
-            rowiter = iter(np.arange(nrows[nf]))
-            num = num_list[nf]
-            for _ in itertools.repeat(None, nrows[nf]): 
-                row = next(rowiter)
-                for col in densities: partial_dicts[nf][col][num[row]] += data_dicts[nf][col][row]
-                for col in velocities+others: partial_dicts[nf][col][num[row]] += others_tmp_dicts[nf][col][row]
-            
-            for col in velocities+others:
-                partial_dicts[nf][col][num_uniques[nf][0]] /= partial_dicts[nf][weighting_dens][num_uniques[nf][0]]         
-            for col in densities: 
-                #partial_dicts[nf][col][num_uniques[nf][0]] -= val0_dict[col] #Commented to avoid nans in the final division on final_dict
-                partial_dicts[nf][col][num_uniques[nf][0]] /= num_uniques[nf][1] 
+            partial = None
+            if cache is not None:
+                cache_file = cache + self._get_file_hash(files[nf]) + setup_hash + '.npz'
+                if os.path.isfile(cache_file): 
+                    partial = dict(np.load(cache_file))
+                    print ('Read cached partial sums for: %s'%files[nf])
+            if partial is None:
+                partial = self._bin_file(files[nf], file_columns, densities, velocities+others, weighting_dens, get_id, 
+                                         index=index, deposit=deposit, kwargs_deposit=kwargs_deposit)
+                if cache is not None: np.savez(cache_file, **partial)
+            sparse_partials.append(partial)
+
+        #*******************************************
+        #MERGING THE SPARSE PARTIALS INTO GLOBAL DICT
+        #*******************************************
+        #Each file contributes its mean density per touched cell, and val0 on the remaining cells.
+        # The weighted properties are accumulated as sum(w*X)/count per file and divided by the total weighting density at the end.
+        print ('Computing combined physical properties...')
+
+        final_dict = {}
+        for col in densities: final_dict[col] = np.zeros(ntotal) + nfiles*val0_dict[col]
+        for col in velocities+others: final_dict[col] = np.zeros(ntotal)
 
+        for nf in range(nfiles):
+            partial = sparse_partials[nf]
+            cells, counts = partial['cells'], partial['counts']
+            for col in densities: final_dict[col][cells] += (val0_dict[col] + partial[col]) / counts - val0_dict[col]
+            for col in velocities+others: final_dict[col][cells] += partial[col] / counts
             print ('Finished merging for: %s'%files[nf])
-        
-        #***************************
-        #FILLING FINAL GLOBAL DICT
-        #***************************
-        print ('Computing combined physical properties...')
-        
-        final_dict = {}        
-        for col in densities: final_dict[col] = np.sum([partial_dicts[nf][col] for nf in range(nfiles)], axis=0)
-        for col in velocities+others: final_dict[col] = np.sum([partial_dicts[nf][weighting_dens] * partial_dicts[nf][col] for nf in range(nfiles)], axis=0) / final_dict[weighting_dens]
+
+        for col in velocities+others: final_dict[col] /= final_dict[weighting_dens]
 
         #******************************************
         #FILLING DICT WITH min_values and 0's
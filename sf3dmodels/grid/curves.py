@@ -0,0 +1,116 @@
+"""
+Space-filling curve orderings (Morton, Hilbert) of grid cells.
+
+Writing the cells of a model along one of these curves keeps spatially neighbouring cells close in memory,
+which turns the random accesses of the radiative transfer codes to the property tables into mostly sequential reads.
+"""
+from __future__ import print_function
+import numpy as np
+
+__all__ = ['morton_keys', 'hilbert_keys', 'curve_order']
+
+def _spread_bits(a):
+    #Inserts two zeros between consecutive bits of the (up to 21-bit) integers in a
+    a = a.astype(np.uint64) & np.uint64(0x1fffff)
+    for shift, mask in [(32, 0x1f00000000ffff), (16, 0x1f0000ff0000ff), (8, 0x100f00f00f00f00f),
+                        (4, 0x10c30c30c30c30c3), (2, 0x1249249249249249)]:
+        a = (a | (a << np.uint64(shift))) & np.uint64(mask)
+    return a
+
+def morton_keys(ijk):
+    """
+    Morton (Z-order) keys of integer cell coordinates.
+
+    Parameters
+    ----------
+    ijk : array_like, shape (npoints, 3)
+       Non-negative integer coordinates, of up to 21 bits each.
+
+    Returns
+    -------
+    keys : `numpy.ndarray` of uint64, shape (npoints,)
+    """
+    ijk = np.asarray(ijk)
+    return (_spread_bits(ijk[:,0]) << np.uint64(2)) | (_spread_bits(ijk[:,1]) << np.uint64(1)) | _spread_bits(ijk[:,2])
+
+def hilbert_keys(ijk, bits):
+    """
+    Hilbert keys of integer cell coordinates (J. Skilling, 2004, AIP Conf. Proc. 707, 381).
+    Consecutive keys are always face-neighbouring cells on a (2**bits)**3 grid.
+
+    Parameters
+    ----------
+    ijk : array_like, shape (npoints, 3)
+       Non-negative integer coordinates, smaller than 2**bits.
+
+    bits : int
+       Number of bits per coordinate, up to 21.
+
+    Returns
+    -------
+    keys : `numpy.ndarray` of uint64, shape (npoints,)
+    """
+    X = np.array(ijk, dtype=np.uint64).T.copy()
+    Q = 1 << (bits-1)
+    while Q > 1: #Inverse undo
+        P = np.uint64(Q - 1)
+        for i in range(3):
+            flip = (X[i] & np.uint64(Q)) != 0
+            X[0][flip] ^= P
+            swap = ~flip
+            t = (X[0][swap] ^ X[i][swap]) & P
+            X[0][swap] ^= t
+            X[i][swap] ^= t
+        Q >>= 1
+    for i in range(1, 3): X[i] ^= X[i-1] #Gray encode
+    t = np.zeros(X.shape[1], dtype=np.uint64)
+    Q = 1 << (bits-1)
+    while Q > 1:
+        t[(X[2] & np.uint64(Q)) != 0] ^= np.uint64(Q - 1)
+        Q >>= 1
+    X ^= t
+    return morton_keys(X.T) #Bits of the transposed coordinates, interleaved from the most significant
+
+def curve_order(xyz, curve='morton', descending_radius=False, nshells=64):
+    """
+    Permutation sorting the cells of a regular grid along a space-filling curve.
+
+    Parameters
+    ----------
+    xyz : array_like, shape (3, npoints)
+       Cell coordinates, e.g. GRID.XYZ.
+
+    curve : 'morton', 'hilbert' or None, optional
+       Space-filling curve. Defaults to 'morton'.
+
+    descending_radius : bool, optional
+       If True, cells are grouped into ``nshells`` radial shells of equal width, written from the outermost to the innermost,
+       and sorted along the curve within each shell, except for the outermost shell, which is sorted by strictly descending radius. 
+       The cells lying on (or close to) the domain radius, those that reorderGrid of LIME may flag as sink points, 
+       then come first and in the same order as in `~sf3dmodels.Model.DataTab_LIME2`; the inner shells, 
+       whose radius is non-increasing from shell to shell, keep the locality of the curve.
+       With curve None all the cells are sorted by strictly descending radius. Defaults to False.
+
+    nshells : int, optional
+       Number of radial shells for descending_radius. Defaults to 64.
+
+    Returns
+    -------
+    perm : `numpy.ndarray`, shape (npoints,)
+       Original index of the cell at each position of the new ordering.
+    """
+    xyz = np.asarray(xyz, dtype=float)
+    if curve is None:
+        if descending_radius: return np.argsort(np.linalg.norm(xyz, axis=0), kind='stable')[::-1]
+        else: return np.arange(xyz.shape[1])
+    ijk = np.array([np.unique(coord, return_inverse=True)[1] for coord in xyz]).T #Node indices of each cell
+    bits = max(1, int(np.ceil(np.log2(ijk.max() + 1))))
+    if bits > 21: raise ValueError('The grid has more than 2**21 nodes along one axis, too many for 64-bit curve keys')
+    if curve == 'morton': keys = morton_keys(ijk)
+    elif curve == 'hilbert': keys = hilbert_keys(ijk, bits)
+    else: raise ValueError("The value '%s' in curve is invalid. Please choose amongst the following: 'morton', 'hilbert', None"%curve)
+    if not descending_radius: return np.argsort(keys, kind='stable')
+    r = np.linalg.norm(xyz, axis=0)
+    shell = np.minimum((r / r.max() * nshells).astype(int), nshells-1) if r.max() > 0 else np.zeros(len(r), dtype=int)
+    r_outer = np.where(shell == shell.max(), r, 0.0) #Only the outermost shell is ordered by radius
+    return np.lexsort((keys, -r_outer, -shell))
@@ -0,0 +1,194 @@
+"""
+Mass-conserving deposition of point samples (submodel rows, SPH particles) onto regular grids.
+
+Each point carries a mass which is spread over the neighbouring grid cells with normalised kernel weights,
+either cloud-in-cell (CIC) or the cubic-spline SPH kernel. Since the weights of each point add up to one,
+the total mass of the points within the grid domain is preserved.
+"""
+from __future__ import print_function
+import multiprocessing
+import numpy as np
+from scipy.spatial import cKDTree
+from .core import NeighbourRegularGrid
+
+__all__ = ['Deposit']
+
+class Deposit(NeighbourRegularGrid):
+    """
+    Host class of the deposition kernels.
+
+    Parameters
+    ----------
+    GRID : `~sf3dmodels.Model.Struct`
+       Regular grid structure receiving the deposited mass (see `~sf3dmodels.Model.grid`).
+
+    rt_code : 'lime' or 'radmc3d', optional
+       Sets the ordering of the output cell ids. Defaults to 'lime'.
+
+    nthreads : int, optional
+       Number of threads used by the kernels. Defaults to None, i.e. the number of available cpus.
+
+    batch_size : int, optional
+       Maximum number of (point, cell) pairs evaluated at once by each thread. Defaults to 2**22.
+
+    tol : float, optional
+       SPH weights below this fraction of the point mass are discarded (and the remaining ones renormalised). Defaults to 1e-6.
+    """
+    def __init__(self, GRID, rt_code='lime', nthreads=None, batch_size=2**22, tol=1e-6):
+        self.GRID = GRID
+        if rt_code == 'lime': self._get_id = self._get_nearest_id_lime
+        elif rt_code == 'radmc3d': self._get_id = self._get_nearest_id_radmc3d
+        else: raise ValueError("The value '%s' in rt_code is invalid. Please choose amongst the following: 'lime', 'radmc3d'"%rt_code)
+        self.nthreads = nthreads if nthreads is not None else multiprocessing.cpu_count()
+        self.batch_size = int(batch_size)
+        self.tol = tol
+        self.nodes = np.asarray(GRID.Nodes).astype(int)
+        self.x0 = np.array([xc[0] for xc in GRID.XYZcentres])
+        self.step = np.array([xc[1]-xc[0] if len(xc) > 1 else 1.0 for xc in GRID.XYZcentres])
+        self.cell_volume = np.prod([self.step[i] if self.nodes[i] > 1 else 1.0 for i in range(3)])
+
+    def _split(self, npoints):
+        nsplit = max(1, min(self.nthreads, npoints))
+        return np.array_split(np.arange(npoints), nsplit)
+
+    def _run_threaded(self, func, npoints, *args):
+        """
+        Evaluates func(ids, *args) on disjoint groups of points and concatenates the returned (cells, ids, weights).
+        """
+        groups = self._split(npoints)
+        if len(groups) == 1: out = [func(groups[0], *args)]
+        else:
+            from concurrent.futures import ThreadPoolExecutor
+            with ThreadPoolExecutor(max_workers=len(groups)) as executor: out = list(executor.map(lambda ids: func(ids, *args), groups))
+        return [np.concatenate([tmp[i] for tmp in out]) for i in range(3)]
+
+    def _nearest(self, xyz):
+        ijk = np.rint((xyz - self.x0) / self.step).astype(int)
+        return np.clip(ijk, 0, self.nodes-1)
+
+    def _cic(self, ids, xyz):
+        s = (xyz[ids] - self.x0) / self.step
+        i0 = np.floor(s).astype(int)
+        t = s - i0
+        cells, weights = [], []
+        for corner in np.ndindex(2,2,2):
+            corner = np.array(corner)
+            ijk = np.clip(i0 + corner, 0, self.nodes-1)
+            weights.append(np.prod(np.where(corner, t, 1-t), axis=1))
+            cells.append(self._get_id(ijk[:,0], ijk[:,1], ijk[:,2], self.nodes))
+        return np.concatenate(cells), np.tile(ids, 8), np.concatenate(weights)
+
+    @staticmethod
+    def _cubic_spline(q):
+        return np.where(q < 1.0, 1 - 1.5*q**2 + 0.75*q**3, np.where(q < 2.0, 0.25*(2-q)**3, 0.0))
+
+    def _sph(self, ids, xyz, h):
+        #Points are grouped by the number of nodes per axis enclosing their kernel support (2h),
+        # and evaluated in batches of at most batch_size (point, node) pairs.
+        nb = (np.ceil(4*h[ids][:,None] / self.step).max(axis=1)).astype(int) + 1
+        cells, owners, weights = [np.empty(0, dtype=int)], [np.empty(0, dtype=int)], [np.empty(0)]
+        for n in np.unique(nb):
+            offsets = np.array(list(np.ndindex(n,n,n)))
+            group = ids[nb == n]
+            nbatch = max(1, self.batch_size // n**3)
+            for b in range(0, len(group), nbatch):
+                g = group[b:b+nbatch]
+                i_lo = np.ceil((xyz[g] - 2*h[g][:,None] - self.x0) / self.step).astype(int)
+                ijk = i_lo[:,None,:] + offsets[None,:,:]
+                inside = np.logical_and(ijk >= 0, ijk < self.nodes).all(axis=2)
+                r = np.linalg.norm(self.x0 + ijk*self.step - xyz[g][:,None,:], axis=2)
+                w = np.where(inside, self._cubic_spline(r / h[g][:,None]), 0.0)
+                wsum = w.sum(axis=1)
+                empty = wsum == 0 #Kernel smaller than the cell size or out of the grid: fall back to the nearest node
+                if empty.any():
+                    ijk[empty,0] = self._nearest(xyz[g][empty])
+                    w[empty,0] = wsum[empty] = 1.0
+                w /= wsum[:,None]
+                w = np.where(w > self.tol, w, 0.0)
+                w /= w.sum(axis=1)[:,None]
+                pair = w > 0
+                ijk = ijk[pair]
+                cells.append(self._get_id(ijk[:,0], ijk[:,1], ijk[:,2], self.nodes))
+                owners.append(np.repeat(g, pair.sum(axis=1)))
+                weights.append(w[pair])
+        return np.concatenate(cells), np.concatenate(owners), np.concatenate(weights)
+
+    def weights(self, xyz, kernel='cic', h=None):
+        """
+        Computes the deposition weights of the input points.
+
+        Parameters
+        ----------
+        xyz : array_like, shape (npoints, 3)
+           Point coordinates.
+
+        kernel : 'cic' or 'sph', optional
+           Cloud-in-cell (8 neighbouring nodes, coordinates clipped to the grid borders) or cubic-spline SPH kernel
+           with compact support 2h (nodes outside the grid are discarded). Defaults to 'cic'.
+
+        h : array_like, shape (npoints,), optional
+           Smoothing lengths. Mandatory for the 'sph' kernel.
+
+        Returns
+        -------
+        cells, ids, weights : `numpy.ndarray`
+           Sparse triplets: grid cell id, point id and weight. The weights of each point add up to one.
+        """
+        xyz = np.asarray(xyz, dtype=float)
+        if kernel == 'cic': return self._run_threaded(self._cic, len(xyz), xyz)
+        elif kernel == 'sph':
+            if h is None: raise ValueError("Smoothing lengths 'h' must be provided for the 'sph' kernel")
+            return self._run_threaded(self._sph, len(xyz), xyz, np.asarray(h, dtype=float))
+        else: raise ValueError("The value '%s' in kernel is invalid. Please choose amongst the following: 'cic', 'sph'"%kernel)
+
+    def knn_volumes(self, xyz, k=32):
+        """
+        Estimates the volume represented by each point and its smoothing length from the distance r_k to its k-th nearest neighbour:
+        V = 4/3 pi r_k**3 / (k-1), and h = r_k / 2 so that the kernel support encloses the k neighbours.
+        Volumes are overestimated for points on the outer boundary of the point distribution.
+
+        Returns
+        -------
+        volume, h : `numpy.ndarray`, shape (npoints,)
+        """
+        xyz = np.asarray(xyz, dtype=float)
+        k = min(int(k), len(xyz)-1)
+        if k < 2: return np.full(len(xyz), self.cell_volume), np.full(len(xyz), self.step.min())
+        tree = cKDTree(xyz)
+        try: dist, _ = tree.query(xyz, k=k+1, workers=self.nthreads) #The point itself is the first neighbour
+        except TypeError: dist, _ = tree.query(xyz, k=k+1, n_jobs=self.nthreads)
+        r_k = dist[:,-1]
+        return 4./3*np.pi*r_k**3 / (k-1), 0.5*r_k
+
+    def mass2grid(self, xyz, mass, fields={}, kernel='cic', h=None):
+        """
+        Deposits the mass of the input points onto the grid.
+
+        Parameters
+        ----------
+        xyz : array_like, shape (npoints, 3)
+           Point coordinates.
+
+        mass : array_like, shape (npoints,)
+           Mass (or any extensive quantity) of each point.
+
+        fields : dict, optional
+           Intensive properties of the points (e.g. temperature, velocity components) to be averaged on each cell, weighted by the deposited mass.
+
+        kernel, h : See `weights`.
+
+        Returns
+        -------
+        out : dict
+           'cells': sorted ids of the touched cells, 'density': deposited mass per cell volume,
+           'mass': deposited mass per cell, and the mass-weighted average of each input field.
+        """
+        cells, ids, w = self.weights(xyz, kernel=kernel, h=h)
+        cells_u, inverse = np.unique(cells, return_inverse=True)
+        mass = np.asarray(mass, dtype=float)
+        mw = w * mass[ids]
+        cell_mass = np.bincount(inverse, weights=mw, minlength=len(cells_u))
+        out = {'cells': cells_u, 'mass': cell_mass, 'density': cell_mass / self.cell_volume}
+        with np.errstate(invalid='ignore', divide='ignore'):
+            for key in fields: out[key] = np.bincount(inverse, weights=mw*np.asarray(fields[key])[ids], minlength=len(cells_u)) / cell_mass
+        return out
@@ -7,6 +7,7 @@ real cells and the border of an eventual radiative transfer domain.
 import numpy as np
 from ..tools.transform import spherical2cartesian
 from .core import Build_r
+from ..utils import trace
 from copy import copy, deepcopy
 
 __all__ = ['Random']
@@ -50,6 +51,7 @@ class Random(Build_r, SmartRejectionDummies):
         self.grid_orig = copy(grid)
         super(Random, self).__init__(grid)
 
+    @trace.stage
     def by_density(self, density, mass_fraction = 0.5, r_max = None, n_dummy = None, r_steps = 100):
         r"""
         Under development.
@@ -98,6 +100,7 @@ class Random(Build_r, SmartRejectionDummies):
         t = 4+4
         return t
 
+    @trace.stage
     def spherical(self, prop, prop_fill = {}, r_min = 0., r_max = None, n_dummy = None):
         r"""
         Fills up the grid with uniformly-distributed random dummy points in a spherical section.
@@ -167,6 +170,7 @@ class Random(Build_r, SmartRejectionDummies):
         print ("Final number of dummies:", n_dummy)
 
         self.GRID.NPoints = self.GRID.NPoints + n_dummy
+        self.GRID.ndummies = getattr(self.GRID, 'ndummies', 0) + n_dummy #Read by the run manifest of the Lime writers
 
         print("New number of grid points:", self.GRID.NPoints)
 
@@ -180,6 +184,7 @@ class Random(Build_r, SmartRejectionDummies):
         return {"r_rand": r_rand, "n_dummy": n_dummy}
 
 
+    @trace.stage
     def by_mass(self, mass, prop, prop_fill = {}, mass_fraction = 0.5, r_max = None, n_dummy = None, r_steps = 100):
         r"""
         Fills up the grid with uniformly-distributed random dummy points in a spherical section based on a mass threshold.
@@ -0,0 +1,174 @@
+"""
+Sidecar spatial index for submodel files.
+
+Keeps the bounding box of a submodel file (see `~sf3dmodels.rt.MakeDatatab.submodel`) together with
+the byte span, bounding box and a coarse occupancy histogram of each chunk of rows in the file.
+`~sf3dmodels.grid.Overlap` uses it to skip the files and chunks that fall outside the hosting grid.
+"""
+from __future__ import print_function
+import os
+import json
+import warnings
+import numpy as np
+
+__all__ = ['SubmodelIndex']
+
+class SubmodelIndex(object):
+    """
+    Bounding-box index of a submodel file, stored next to it as '<file>.idx'.
+
+    Parameters
+    ----------
+    file : str
+       Path to the submodel file.
+
+    xyz_cols : array_like, shape (3,), optional
+       Column indices of the x, y, z coordinates in the submodel file. Defaults to [1,2,3].
+
+    chunk_size : int, optional
+       Number of rows per chunk. Defaults to 10000.
+
+    nbins : int, optional
+       Number of divisions per axis of the coarse histogram computed for each chunk. Defaults to 4.
+
+    Attributes
+    ----------
+    bbox : `numpy.ndarray`, shape (2,3)
+       Minimum and maximum x, y, z of the whole file. None if the file has no rows (e.g. empty or header-only).
+
+    chunks : list of dict
+       One dictionary per chunk with keys 'offset' and 'nbytes' (byte span in file), 'nrows',
+       'bbox' (shape (2,3)) and 'hist' (flattened occupancy histogram, length ``nbins**3``).
+    """
+    ext = '.idx'
+
+    def __init__(self, file, xyz_cols=[1,2,3], chunk_size=10000, nbins=4):
+        self.file = file
+        self.xyz_cols = [int(col) for col in xyz_cols]
+        self.chunk_size = int(chunk_size)
+        self.nbins = int(nbins)
+        self.bbox = None
+        self.chunks = []
+
+    @classmethod
+    def index_path(cls, file):
+        return file + cls.ext
+
+    def _file_stamp(self):
+        stat = os.stat(self.file)
+        return {'size': stat.st_size, 'mtime': stat.st_mtime}
+
+    def _chunk_info(self, lines, offset):
+        nbytes = sum(len(line) for line in lines)
+        with warnings.catch_warnings():
+            warnings.simplefilter('ignore', category=UserWarning) #Chunks made only of comment lines
+            xyz = np.loadtxt([line.decode() if isinstance(line, bytes) else line for line in lines],
+                             usecols=self.xyz_cols, ndmin=2)
+        if len(xyz) == 0: return {'offset': offset, 'nbytes': nbytes, 'nrows': 0}
+        lo, hi = xyz.min(axis=0), xyz.max(axis=0)
+        width = np.where(hi > lo, hi - lo, 1.0)
+        ijk = np.clip(((xyz - lo) / width * self.nbins).astype(int), 0, self.nbins-1)
+        flat = (ijk[:,0]*self.nbins + ijk[:,1])*self.nbins + ijk[:,2]
+        hist = np.bincount(flat, minlength=self.nbins**3)
+        return {'offset': offset, 'nbytes': nbytes, 'nrows': len(xyz),
+                'bbox': np.array([lo, hi]), 'hist': hist}
+
+    def build(self, lines=None):
+        """
+        Computes the index.
+
+        Parameters
+        ----------
+        lines : list of str, optional
+           Rows of the submodel file, exactly as written into it. If None, the rows are read from ``file``.
+        """
+        if lines is None:
+            with open(self.file, 'rb') as f: lines = f.readlines()
+        self.chunks = []
+        offset = 0
+        for i in range(0, len(lines), self.chunk_size):
+            chunk = self._chunk_info(lines[i:i+self.chunk_size], offset)
+            offset += chunk['nbytes']
+            if chunk['nrows'] > 0: self.chunks.append(chunk) #Chunks without rows are never read
+        if len(self.chunks) == 0: self.bbox = None
+        else:
+            boxes = np.array([chunk['bbox'] for chunk in self.chunks])
+            self.bbox = np.array([boxes[:,0].min(axis=0), boxes[:,1].max(axis=0)])
+        return self
+
+    def write(self):
+        """
+        Writes the index into '<file>.idx'. Must be invoked once the submodel file is closed.
+        """
+        tmp = {'xyz_cols': self.xyz_cols, 'chunk_size': self.chunk_size, 'nbins': self.nbins,
+               'bbox': self.bbox.tolist() if self.bbox is not None else None, 'stamp': self._file_stamp(),
+               'chunks': [{'offset': chunk['offset'], 'nbytes': chunk['nbytes'], 'nrows': chunk['nrows'],
+                           'bbox': chunk['bbox'].tolist(), 'hist': chunk['hist'].tolist()} for chunk in self.chunks]}
+        with open(self.index_path(self.file), 'w') as f: json.dump(tmp, f)
+
+    @classmethod
+    def load(cls, file, xyz_cols=[1,2,3]):
+        """
+        Reads the index of ``file``. Returns None if there is no index, if it is outdated with respect to the
+        submodel file or if it was computed for different coordinate columns.
+        """
+        path = cls.index_path(file)
+        if not os.path.isfile(path): return None
+        with open(path, 'r') as f: tmp = json.load(f)
+        index = cls(file, xyz_cols=tmp['xyz_cols'], chunk_size=tmp['chunk_size'], nbins=tmp['nbins'])
+        if tmp['stamp'] != index._file_stamp() or index.xyz_cols != list(xyz_cols): return None
+        index.bbox = np.array(tmp['bbox']) if tmp['bbox'] is not None else None
+        index.chunks = [{'offset': chunk['offset'], 'nbytes': chunk['nbytes'], 'nrows': chunk['nrows'],
+                         'bbox': np.array(chunk['bbox']), 'hist': np.array(chunk['hist'])} for chunk in tmp['chunks']]
+        return index
+
+    @classmethod
+    def get(cls, file, xyz_cols=[1,2,3], **kwargs):
+        """
+        Returns the index of ``file``, (re)building and writing it if missing or outdated.
+        """
+        index = cls.load(file, xyz_cols=xyz_cols)
+        if index is None:
+            print ('Building spatial index for %s'%file)
+            index = cls(file, xyz_cols=xyz_cols, **kwargs).build()
+            index.write()
+        return index
+
+    def _chunk_overlaps(self, chunk, lo, hi):
+        c_lo, c_hi = chunk['bbox']
+        if (c_hi < lo).any() or (c_lo > hi).any(): return False
+        width = (c_hi - c_lo) / self.nbins
+        ijk = np.array(np.unravel_index(np.nonzero(chunk['hist'])[0], (self.nbins,)*3)).T
+        b_lo = c_lo + ijk*width
+        b_hi = np.where(ijk == self.nbins-1, c_hi, b_lo + width)
+        return np.logical_and(b_hi >= lo, b_lo <= hi).all(axis=1).any()
+
+    def select(self, lo, hi):
+        """
+        Returns the ids of the chunks with at least one occupied histogram bin overlapping the box [lo, hi].
+
+        Parameters
+        ----------
+        lo, hi : array_like, shape (3,)
+           Lower and upper corners of the region of interest.
+        """
+        lo, hi = np.asarray(lo), np.asarray(hi)
+        if self.bbox is None: return []
+        if (self.bbox[1] < lo).any() or (self.bbox[0] > hi).any(): return []
+        return [i for i, chunk in enumerate(self.chunks) if self._chunk_overlaps(chunk, lo, hi)]
+
+    def read(self, chunk_ids, ncols):
+        """
+        Reads only the bytes of the requested chunks from the submodel file.
+
+        Returns
+        -------
+        data : `numpy.ndarray`, shape (nrows, ncols)
+        """
+        data = [np.empty((0, ncols))]
+        with open(self.file, 'rb') as f:
+            for i in chunk_ids:
+                f.seek(self.chunks[i]['offset'])
+                lines = f.read(self.chunks[i]['nbytes']).decode().splitlines()
+                data.append(np.loadtxt(lines, ndmin=2))
+        return np.concatenate(data)
@@ -0,0 +1,126 @@
+"""
+Nearest-cell index for irregular (Voronoi, SPH, random) cell sets.
+
+Lets the model callbacks of the radiative transfer codes look up the cell nearest to any (x,y,z), so that `LIME`_ can
+sample its own point distribution against the model instead of reusing the model cells one by one via their id.
+The index is a balanced k-d tree stored implicitly in the row order of a binary table (see `~sf3dmodels.rt.BinaryTable`),
+which is built once by sf3dmodels and read by the model file without any further construction.
+"""
+from __future__ import print_function
+import inspect
+import numpy as np
+from scipy.spatial import cKDTree
+
+__all__ = ['CellTree']
+
+class CellTree(object):
+    """
+    k-d tree of cell positions.
+
+    Parameters
+    ----------
+    xyz : array_like, shape (3, ncells)
+       Cell coordinates, e.g. GRID.XYZ.
+
+    ids : array_like, shape (ncells,), optional
+       Cell ids. Defaults to None, i.e. np.arange(ncells).
+
+    Notes
+    -----
+    In the written table (`write`) the node of the rows [lo,hi) is the row mid = lo + (hi-lo)/2, split along the axis depth%3;
+    the rows [lo,mid) lie on the lower side and [mid+1,hi) on the upper side. A nearest-cell search in C reads:
+
+    .. code-block:: c
+
+       void kd_nearest(double **xyz, long lo, long hi, int depth, double *p, long *best, double *best_d2){
+         long mid; double d[3], d2, diff;
+         if (lo >= hi) return;
+         mid = lo + (hi-lo)/2;
+         d[0] = p[0]-xyz[0][mid]; d[1] = p[1]-xyz[1][mid]; d[2] = p[2]-xyz[2][mid];
+         d2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+         if (d2 < *best_d2) {*best_d2 = d2; *best = mid;}
+         diff = d[depth%3];
+         if (diff < 0) {kd_nearest(xyz, lo, mid, depth+1, p, best, best_d2); if (diff*diff < *best_d2) kd_nearest(xyz, mid+1, hi, depth+1, p, best, best_d2);}
+         else {kd_nearest(xyz, mid+1, hi, depth+1, p, best, best_d2); if (diff*diff < *best_d2) kd_nearest(xyz, lo, mid, depth+1, p, best, best_d2);}
+       }
+
+    called with lo=0, hi=nrows, depth=0 and *best_d2 = HUGE_VAL. The cell id is then the id column of the row ``best``.
+    """
+    def __init__(self, xyz, ids=None):
+        self.xyz = np.asarray(xyz, dtype=float)
+        self.ncells = self.xyz.shape[1]
+        self.ids = np.arange(self.ncells) if ids is None else np.asarray(ids)
+        self._tree = None
+
+    @classmethod
+    def from_table(cls, table):
+        """
+        Index of the cells of a binary table with x, y, z columns (ids 1-3), e.g. written by `~sf3dmodels.rt.MakeDatatab.submodel`
+        and converted with `~sf3dmodels.rt.BinaryTable.from_datatab`.
+        """
+        cols = [table.col_ids.index(i) for i in [1,2,3]]
+        ids = table.column(table.col_ids.index(0)) if 0 in table.col_ids else None
+        return cls([table.column(i) for i in cols], ids=ids)
+
+    @property
+    def tree(self):
+        if self._tree is None: self._tree = cKDTree(self.xyz.T)
+        return self._tree
+
+    def query(self, points):
+        """
+        Nearest cell of each point.
+
+        Parameters
+        ----------
+        points : array_like, shape (3, npoints)
+
+        Returns
+        -------
+        ids : `numpy.ndarray`, shape (npoints,)
+           Id of the nearest cell.
+
+        dist : `numpy.ndarray`, shape (npoints,)
+           Distance to the nearest cell.
+        """
+        dist, i = self.tree.query(np.asarray(points, dtype=float).T)
+        return self.ids[i], dist
+
+    def tree_order(self):
+        """
+        Row order of the implicit k-d tree described in the **Notes**. The rows of each level are sorted at once,
+        within their segments, with a single lexsort.
+
+        Returns
+        -------
+        perm : `numpy.ndarray`, shape (ncells,)
+           Original index of the cell at each row.
+        """
+        n = self.ncells
+        perm = np.arange(n)
+        starts = np.zeros(n+1, dtype=bool)
+        starts[0] = starts[n] = True
+        depth = 0
+        while True:
+            lo = np.nonzero(starts[:-1])[0]
+            length = np.diff(np.append(lo, n))
+            split = length > 1
+            if not split.any(): break
+            seg = np.cumsum(starts[:-1]) - 1
+            perm = perm[np.lexsort((self.xyz[depth%3][perm], seg))]
+            mid = lo[split] + length[split]//2
+            starts[mid] = True
+            starts[mid+1] = True
+            depth += 1
+        return perm
+
+    def write(self, file='cells_kdtree.bin'):
+        """
+        Writes the cell ids and coordinates, in k-d tree order, into a binary table (float64 coordinates).
+        """
+        from ..rt.table import BinaryTable
+        perm = self.tree_order()
+        print ('Writing k-d tree of %d cells into %s'%(self.ncells, file))
+        table = BinaryTable.write(file, [0,1,2,3], [self.ids[perm]] + [coord[perm] for coord in self.xyz], storage='float64')
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+        return table
@@ -0,0 +1,171 @@
+"""
+Gridding of SPH particle snapshots (e.g. from the `Phantom`_ code).
+
+Turns particle positions, masses and smoothing lengths into densities, temperatures and velocities
+on a regular `~sf3dmodels.Model.grid`, via mass-conserving deposition, or on any (adaptive) point set,
+via standard SPH interpolation. The output dictionaries can be passed straight to `~sf3dmodels.rt.Lime`.
+"""
+from __future__ import print_function
+import multiprocessing
+import inspect
+import numpy as np
+from scipy.spatial import cKDTree
+from . import GridSet
+from .deposit import Deposit
+from ..utils.constants import temp_cmb
+from ..utils.prop import propTags
+
+__all__ = ['SPHGrid']
+
+class SPHGrid(GridSet):
+    """
+    Host class of the SPH gridding methods.
+
+    Parameters
+    ----------
+    GRID : `~sf3dmodels.Model.Struct`
+       Target grid. Regular grid (see `~sf3dmodels.Model.grid`) for `deposit`, or any structure with
+       ``XYZ`` and ``NPoints`` attributes for `interpolate`.
+
+    xyz : array_like, shape (3, nparticles)
+       Particle positions, in the same units of the ``GRID``.
+
+    mass : array_like, shape (nparticles,)
+       Particle masses, in kg.
+
+    h : array_like, shape (nparticles,)
+       Particle smoothing lengths. The cubic-spline kernel has compact support 2h.
+
+    nthreads : int, optional
+       Number of threads. Defaults to None, i.e. the number of available cpus.
+
+    Attributes
+    ----------
+    min_values : dict
+       Values assigned to the properties of empty cells (or points with no particles within reach).
+       Properties not listed here are set to 0.
+    """
+    def __init__(self, GRID, xyz, mass, h, nthreads=None):
+        super(SPHGrid, self).__init__(GRID)
+        self.xyz = np.asarray(xyz, dtype=float).T
+        self.mass = np.asarray(mass, dtype=float)
+        self.h = np.asarray(h, dtype=float)
+        if not len(self.xyz) == len(self.mass) == len(self.h): raise ValueError('xyz, mass and h must have the same number of particles')
+        self.nthreads = nthreads if nthreads is not None else multiprocessing.cpu_count()
+        self.min_values = {'dens_H': 1e3,
+                           'dens_H2': 1e3,
+                           'dens_Hplus': 1e3,
+                           'dens_ion': 1e3,
+                           'dens_e': 1e3,
+                           'temp_gas': temp_cmb,
+                           'temp_dust': temp_cmb,
+                           }
+
+    @staticmethod
+    def _kernel(r, h):
+        """
+        Normalised 3D cubic-spline kernel W(r,h), with compact support 2h.
+        """
+        q = r / h
+        return np.where(q < 1.0, 1 - 1.5*q**2 + 0.75*q**3, np.where(q < 2.0, 0.25*(2-q)**3, 0.0)) / (np.pi*h**3)
+
+    def _to_prop(self, dens_mass, fields, cells, npoints, dens_tag):
+        prop = {}
+        dens = np.zeros(npoints)
+        dens[cells] = dens_mass[cells] / propTags.get_dens_mass(dens_tag)
+        prop[dens_tag] = np.where(dens < self.min_values.get(dens_tag, 0.0), self.min_values.get(dens_tag, 0.0), dens)
+        for key in fields:
+            prop[key] = np.full(npoints, self.min_values.get(key, 0.0))
+            prop[key][cells] = fields[key][cells]
+        return prop
+
+    def deposit(self, fields={}, dens_tag='dens_H2', rt_code='lime', batch_size=2**22):
+        """
+        Deposits the particles onto the regular ``GRID`` with the cubic-spline kernel of each particle (see `~sf3dmodels.grid.Deposit`).
+
+        The kernel weights of each particle are normalised on the grid nodes, so the total mass of the particles is preserved
+        even if their smoothing lengths are smaller than the cell size. The ``fields`` are mass-weighted averages on each cell.
+
+        Parameters
+        ----------
+        fields : dict, optional
+           Particle properties to grid, e.g. {'temp_gas': T, 'vel_x': vx, 'vel_y': vy, 'vel_z': vz}.
+
+        dens_tag : str, optional
+           Name of the output number density. The particle mass is converted using the mass of the species (see `~sf3dmodels.utils.prop.propTags`).
+           Defaults to 'dens_H2'.
+
+        rt_code : 'lime' or 'radmc3d', optional
+           Ordering of the output cells. Defaults to 'lime'.
+
+        batch_size : int, optional
+           Maximum number of (particle, node) pairs evaluated at once by each thread. Defaults to 2**22.
+
+        Returns
+        -------
+        prop : dict
+           Gridded properties, with shape (GRID.NPoints,). Ready to be written with `~sf3dmodels.rt.Lime.finalmodel`.
+        """
+        dep = Deposit(self.GRID, rt_code=rt_code, nthreads=self.nthreads, batch_size=batch_size)
+        out = dep.mass2grid(self.xyz, self.mass, fields=fields, kernel='sph', h=self.h)
+        npoints = self.GRID.NPoints
+        dens_mass, tmp = np.zeros(npoints), {}
+        dens_mass[out['cells']] = out['density']
+        for key in fields:
+            tmp[key] = np.zeros(npoints)
+            tmp[key][out['cells']] = out[key]
+        print ('Deposited %d particles on %d cells'%(len(self.mass), len(out['cells'])))
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+        return self._to_prop(dens_mass, tmp, out['cells'], npoints, dens_tag)
+
+    def _interpolate_bin(self, ids, tree):
+        #All the particles in the bin are within 2*h_max of their neighbour points
+        h = self.h[ids]
+        pairs = tree.sparse_distance_matrix(cKDTree(self.xyz[ids]), 2*h.max(), output_type='ndarray')
+        i, j, r = pairs['i'], pairs['j'], pairs['v']
+        w = self.mass[ids][j] * self._kernel(r, h[j])
+        keep = w > 0
+        return i[keep], ids[j[keep]], w[keep]
+
+    def interpolate(self, fields={}, dens_tag='dens_H2', hbins=2.0):
+        """
+        Interpolates the particle properties onto the points of ``GRID`` (e.g. the particle positions themselves, or an adaptive point set),
+        using the scatter SPH estimates: rho(x) = sum_j m_j W(|x - x_j|, h_j), and f(x) = sum_j m_j f_j W / rho.
+
+        Points with no particles within reach take the fields of their nearest particle and the ``min_values`` density.
+
+        Parameters
+        ----------
+        fields, dens_tag : See `deposit`.
+
+        hbins : float, optional
+           Particles are grouped in bins of smoothing lengths spanning this factor, and the neighbour search of each bin,
+           based on k-d trees, runs on its own thread. Defaults to 2.0.
+
+        Returns
+        -------
+        prop : dict
+           Interpolated properties, with shape (GRID.NPoints,). Ready to be written with `~sf3dmodels.rt.Lime.submodel`.
+        """
+        xyz_out = np.asarray(self.GRID.XYZ, dtype=float).T
+        npoints = len(xyz_out)
+        tree = cKDTree(xyz_out)
+        logh = np.log(self.h) / np.log(hbins)
+        hbin = np.floor(logh - logh.min()).astype(int)
+        groups = [np.nonzero(hbin == b)[0] for b in np.unique(hbin)]
+        from concurrent.futures import ThreadPoolExecutor
+        with ThreadPoolExecutor(max_workers=max(1, min(self.nthreads, len(groups)))) as executor:
+            out = list(executor.map(lambda ids: self._interpolate_bin(ids, tree), groups))
+        i, j, w = [np.concatenate([tmp[n] for tmp in out]) for n in range(3)]
+
+        dens_mass = np.bincount(i, weights=w, minlength=npoints)
+        tmp = {}
+        with np.errstate(invalid='ignore', divide='ignore'):
+            for key in fields: tmp[key] = np.bincount(i, weights=w*np.asarray(fields[key])[j], minlength=npoints) / dens_mass
+        empty = dens_mass == 0
+        if empty.any():
+            _, nearest = cKDTree(self.xyz).query(xyz_out[empty])
+            for key in fields: tmp[key][empty] = np.asarray(fields[key])[nearest]
+            print ('%d points with no particles within reach, using the fields of their nearest particle'%empty.sum())
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+        return self._to_prop(dens_mass, tmp, np.arange(npoints), npoints, dens_tag)
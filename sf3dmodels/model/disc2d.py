@@ -20,6 +20,8 @@ import emcee
 import copy
 import time
 import os
+import threading
+import weakref
 
 from multiprocessing import Pool
 os.environ["OMP_NUM_THREADS"] = "1"
@@ -71,6 +73,85 @@ class InputError(Exception):
     def __str__(self):
         return '%s --> %s'%(self.expression, self.message)
 
+class SharedArrays(object):
+    """
+    Places read-only arrays in shared memory so that the processes of a pool can map them instead of receiving copies.
+    Arrays are described by (name, shape, dtype) tuples, which are cheap to pickle.
+    """
+    def __init__(self):
+        self._shm = {}
+
+    @staticmethod
+    def available():
+        try: from multiprocessing import shared_memory
+        except ImportError: return False
+        return True
+
+    def share(self, arr):
+        from multiprocessing import shared_memory
+        arr = np.ascontiguousarray(arr)
+        if id(arr) in self._shm: return self._shm[id(arr)][1]
+        shm = shared_memory.SharedMemory(create=True, size=max(1, arr.nbytes))
+        np.ndarray(arr.shape, dtype=arr.dtype, buffer=shm.buf)[...] = arr
+        desc = ('__shared__', shm.name, arr.shape, arr.dtype.str)
+        self._shm[id(arr)] = (shm, desc, arr)
+        return desc
+
+    @staticmethod
+    def is_shared(desc):
+        return isinstance(desc, tuple) and len(desc) == 4 and desc[0] == '__shared__'
+
+    @staticmethod
+    def attach(desc, keep):
+        """
+        Returns a read-only view of the shared array. The handle is appended to ``keep``, which must outlive the view.
+        """
+        from multiprocessing import shared_memory
+        shm = shared_memory.SharedMemory(name=desc[1])
+        keep.append(shm)
+        arr = np.ndarray(desc[2], dtype=np.dtype(desc[3]), buffer=shm.buf)
+        arr.flags.writeable = False
+        return arr
+
+    def close(self):
+        for shm, desc, arr in self._shm.values():
+            shm.close()
+            shm.unlink()
+        self._shm = {}
+
+
+_mc_worker = {'model': None, 'shm': []} #Model instance held by each process of the shared-memory pool
+
+def _mc_worker_init(cls, state, nthreads):
+    try: #numpy is already loaded at this point, OMP_NUM_THREADS would be ignored
+        from threadpoolctl import threadpool_limits
+        threadpool_limits(nthreads)
+    except ImportError: pass
+    keep, views = _mc_worker['shm'], {}
+    def attach(desc): #The same shared block always maps to the same view object
+        if desc[1] not in views: views[desc[1]] = SharedArrays.attach(desc, keep)
+        return views[desc[1]]
+    for key, val in state.items():
+        if SharedArrays.is_shared(val): state[key] = attach(val)
+        elif isinstance(val, list) and len(val) and all(SharedArrays.is_shared(v) for v in val): state[key] = [attach(v) for v in val]
+    model = cls.__new__(cls)
+    model.__dict__.update(state)
+    model._mc_nthreads = nthreads
+    _mc_worker['model'] = model
+
+def _mc_worker_ln_likelihood(new_params, **kwargs):
+    return _mc_worker['model'].ln_likelihood(new_params, **kwargs)
+
+def _close_pool(pool, shared):
+    pool.terminate()
+    pool.join()
+    shared.close()
+
+def _mc_worker_map(args):
+    kind, params_list, kwargs = args
+    return _mc_worker['model']._map_chunk(kind, params_list, **kwargs)
+
+
 class Tools:
     @staticmethod
     def _rotate_sky_plane(x, y, ang):
@@ -108,6 +189,54 @@ class Tools:
         z_pro = y * sin_incl + z * cos_incl
         return x_pro, y_pro, z_pro
 
+    @staticmethod
+    def make_fits_memmap(output, shape, dtype=np.float32, **kw_header):
+        """
+        Writes the header of a FITS file with a pre-allocated (zero-filled) data unit of the input shape, 
+        and returns a writable memory map of that data unit. Data are stored big-endian, as FITS requires.
+        """
+        from astropy.io import fits
+        dtype = np.dtype(dtype)
+        hdr = fits.PrimaryHDU(data=np.zeros((1,)*len(shape), dtype=dtype)).header #Sets BITPIX and NAXISn
+        for i, n in enumerate(shape[::-1]): hdr['NAXIS%d'%(i+1)] = n
+        hdr.update(**kw_header)
+        head = hdr.tostring().encode('ascii')
+        nbytes = int(np.prod(shape)) * dtype.itemsize
+        with open(output, 'wb') as f:
+            f.write(head)
+            f.seek(len(head) + -(-nbytes//2880)*2880 - 1) #Data unit padded to 2880-byte blocks
+            f.write(b'\0')
+        return np.memmap(output, dtype=dtype.newbyteorder('>'), mode='r+', offset=len(head), shape=tuple(shape))
+
+    @staticmethod
+    def _get_interp_operator(x, y, mesh):
+        """
+        Sparse linear-interpolation operator from the scattered points (x, y) onto the mesh nodes.
+        Equivalent to griddata(..., method='linear'), but the Delaunay triangulation and barycentric weights
+        are computed only once and reused for any number of properties.
+
+        Returns
+        -------
+        operator : `scipy.sparse.csr_matrix`, shape (mesh.size, x.size)
+        outside : array_like, shape (mesh.size,)
+           Mask of the mesh nodes out of the convex hull of the points (nan-valued in griddata).
+        """
+        from scipy.spatial import Delaunay
+        from scipy.sparse import csr_matrix
+        points = np.array([x, y]).T
+        xi = np.array([mesh[0].ravel(), mesh[1].ravel()]).T
+        tri = Delaunay(points)
+        simplex = tri.find_simplex(xi)
+        outside = simplex < 0
+        T = tri.transform[simplex] #Rows for outside nodes are meaningless, their weights are discarded below
+        b = np.einsum('ijk,ik->ij', T[:,:2], xi - T[:,2])
+        weights = np.c_[b, 1 - b.sum(axis=1)]
+        weights[outside] = 0
+        rows = np.repeat(np.arange(len(xi)), 3)
+        cols = tri.simplices[simplex].ravel()
+        operator = csr_matrix((weights.ravel(), (rows, cols)), shape=(len(xi), len(points)))
+        return operator, outside
+
     @staticmethod
     def _compute_prop(grid, prop_funcs, prop_kwargs):
         n_funcs = len(prop_funcs)
@@ -484,6 +613,37 @@ class Cube(object):
         if isinstance(tb, dict):
             if tb['nu'] and tb['beam']: self.data = Tools._get_tb(self.data, tb['nu'], tb['beam'])
 
+    @classmethod
+    def from_fits(cls, file, channels=None, beam=False, beam_kernel=False):
+        """
+        Opens a FITS cube lazily: the data are memory-mapped and channels are only read from disk when accessed,
+        e.g. by `show`, `box`, `cursor` or `make_gif`.
+
+        Parameters
+        ----------
+        file : str
+           Path to the FITS file, e.g. written by `~sf3dmodels.model.disc2d.Intensity.get_cube` with ``output``.
+
+        channels : array_like, optional
+           Velocity channels. Defaults to None, i.e. computed from the CRVAL3, CDELT3 and CRPIX3 keywords.
+        """
+        from astropy.io import fits
+        hdul = fits.open(file, memmap=True)
+        data = hdul[0].data
+        if channels is None:
+            hdr = hdul[0].header
+            channels = hdr['CRVAL3'] + (np.arange(len(data)) + 1 - hdr.get('CRPIX3', 1)) * hdr['CDELT3']
+        cube = cls(len(data), channels, data, beam=beam, beam_kernel=beam_kernel)
+        cube._hdul = hdul #Keeps the file open
+        return cube
+
+    @staticmethod
+    def _get_max(cubes):
+        """
+        Maximum of the cubes, computed channel by channel to avoid loading memory-mapped cubes at once.
+        """
+        return np.max([np.max(chan) for cube in cubes for chan in cube.data])
+
     @property
     def interactive(self): 
         return self._interactive
@@ -667,7 +827,7 @@ class Cube(object):
 
         y0, y1 = ax[1].get_position().y0, ax[1].get_position().y1
         axcbar = plt.axes([0.47, y0, 0.03, y1-y0])
-        max_data = np.max([self.data]+[comp.data for comp in compare_cubes])
+        max_data = Cube._get_max([self]+compare_cubes)
         ax[0].set_xlabel(pos_unit)
         ax[0].set_ylabel(pos_unit)
         ax[1].set_xlabel('l.o.s velocity [%s]'%vel_unit)
@@ -870,7 +1030,7 @@ class Cube(object):
 
         y0, y1 = ax[1].get_position().y0, ax[1].get_position().y1
         axcbar = plt.axes([0.47, y0, 0.03, y1-y0])
-        max_data = np.max(self.data)
+        max_data = Cube._get_max([self])
         ax[0].set_xlabel(pos_unit)
         ax[0].set_ylabel(pos_unit)
         ax[1].set_xlabel('Pixel id along path')
@@ -979,11 +1139,10 @@ class Cube(object):
         """
 
     def make_fits(self, output, **kw_header):
-        from astropy.io import fits
-        hdr = fits.Header()
-        hdr.update(**kw_header)
-        data = np.where(np.isfinite(self.data), self.data, 0)
-        fits.writeto(output, data, hdr, overwrite=True)
+        #Written channel by channel, non-finite values are replaced by 0
+        data = Tools.make_fits_memmap(output, np.shape(self.data), dtype=self.data.dtype, **kw_header)
+        for i, chan in enumerate(self.data): data[i] = np.where(np.isfinite(chan), chan, 0)
+        data.flush()
     
     def make_gif(self, folder='./movie/', extent=None, velocity2d=None, 
                  unit=r'Brightness Temperature [K]',
@@ -991,7 +1150,7 @@ class Cube(object):
         cwd = os.getcwd()
         if folder[-1] != '/': folder+='/'
         os.system('mkdir %s'%folder)
-        max_data = np.max(self.data)
+        max_data = Cube._get_max([self])
 
         clear_list, coll_list = [], []
         fig, ax = plt.subplots()
@@ -1152,7 +1311,102 @@ class Velocity:
         return vel_sign*np.sqrt(G*Mstar/r**3)*R * 1e-3 
 
 
+class ProfileTable(object):
+    """
+    Tabulated line profile f(u) or f(u, t), with u = |v - v_chan| / v_sigma.
+
+    The u axis is split into cells uniform in the compact variable 1/(1+u), which covers u in [0, inf) and 
+    resolves the slowly decaying wings of the bell profiles. Each cell stores the exact profile at its centre and is looked up 
+    by nearest cell. The optional t axis (e.g. channel_width / v_sigma) is sampled at uniform nodes within ``t_range`` 
+    and interpolated linearly, which costs one pass per pixel row instead of one per channel. Starting from a coarse table, 
+    the resolution is doubled along the axis with the largest error, measured against the exact profile at the cell borders (u) 
+    and halfway between nodes (t), until the sum of both errors is below ``tol``.
+
+    Parameters
+    ----------
+    func : callable
+       Exact profile, func(u) or func(u, t). Must be vectorised and accept u = inf.
+
+    tol : float, optional
+       Maximum absolute error of the lookup. The profiles of `Intensity` peak at 1, so this is also the error relative to the line peak.
+       Defaults to 1e-3.
+
+    t_range : tuple, optional
+       Range of the second variable of func. Defaults to None, i.e. func(u).
+
+    max_size : int, optional
+       Maximum number of cells. If reached before ``tol``, the table is kept and a warning is issued. Defaults to 2**22.
+    """
+    def __init__(self, func, tol=1e-3, t_range=None, max_size=2**22):
+        self.tol = tol
+        self.t_range = t_range
+        n, m = 256, 1 if t_range is None else 9
+        while True:
+            table, err_u, err_t = self._build(func, n, m)
+            self.error = err_u + err_t
+            if self.error < tol: break
+            if 2*n*m > max_size:
+                warnings.warn('ProfileTable reached max_size=%d with error %.1e > tol=%.1e'%(max_size, self.error, tol))
+                break
+            if err_u >= err_t: n *= 2
+            else: m = 2*m - 1
+        self.n, self.m = n, m
+        #Row i holds the cells 1/(1+u) in [i/n, (i+1)/n), plus a last row for u=0
+        self.table = table.ravel()
+        self._diff_t = np.diff(table, axis=1, append=table[:,-1:]).ravel()
+
+    def _build(self, func, n, m):
+        s_c, s_e = (np.arange(n) + 0.5) / n, np.arange(n+1) / n
+        with np.errstate(divide='ignore'): u_c, u_e = 1/s_c - 1, 1/s_e - 1
+        if self.t_range is None: f, t, t_mid = (lambda u, t: func(u)), None, None
+        else:
+            f, t = func, np.linspace(self.t_range[0], self.t_range[1], m)[None,:]
+            t_mid = 0.5*(t[:,1:] + t[:,:-1])
+        with np.errstate(invalid='ignore', over='ignore'):
+            centre = f(u_c[:,None], t) * np.ones((1, m))
+            edge_u = f(u_e[:,None], t) * np.ones((1, m))
+            err_u = max(np.abs(edge_u[:-1] - centre).max(), np.abs(edge_u[1:] - centre).max())
+            err_t = 0.0 if t is None else np.abs(f(u_c[:,None], t_mid) - 0.5*(centre[:,1:] + centre[:,:-1])).max()
+            peak = f(np.zeros((1,1)), t) * np.ones((1, m))
+        return np.concatenate([centre, peak]), err_u, err_t
+
+    def in_range(self, t):
+        """
+        Returns True if all the finite values of t are within t_range.
+        """
+        if self.t_range is None: return True
+        return not (np.nanmin(t) < self.t_range[0] or np.nanmax(t) > self.t_range[1])
+
+    def __call__(self, dv, v_sigma, t=None, out=None):
+        """
+        Looks up the profile at u = |dv| / v_sigma (and t). ``dv`` is overwritten if passed as ``out``.
+        Inputs must be finite, the callers restore the nan outputs.
+        """
+        n, m = self.n, self.m
+        y = np.abs(dv, out=out)
+        y += v_sigma
+        np.divide(n*v_sigma, y, out=y) #n/(1+u), in (0, n]
+        with np.errstate(invalid='ignore'): ids = y.astype(np.intp) #nan -> any index
+        if self.t_range is None: return self.table.take(ids, mode='clip', out=y)
+        lo, hi = self.t_range
+        y_t = np.clip(np.subtract(t, lo) * ((m-1) / (hi - lo)), 0, m-1)
+        with np.errstate(invalid='ignore'): j = np.minimum(y_t.astype(np.intp), m-2)
+        ids *= m
+        ids += j
+        prof = self.table.take(ids, mode='clip', out=y)
+        slope = self._diff_t.take(ids, mode='clip')
+        slope *= y_t - j
+        prof += slope
+        return prof
+
+
 class Intensity:   
+    beam_conv_method = 'fft' #'fft' or 'direct' (astropy.convolution.convolve on each channel)
+    profile_table_tol = 1e-3 #Error bound of the tabulated line profiles, see use_profile_table
+    profile_table_widths = (0.0, 4.0) #Range of channel_width / v_sigma tabulated for the _full profiles
+    stream_block_size = 2**24 #(channel, pixel) elements per block written by get_cube with output
+    _profile_tables_lock = threading.Lock()
+
     @property
     def beam_info(self):
         return self._beam_info
@@ -1178,6 +1432,7 @@ class Intensity:
         y_stddev = beam_kernel.model.y_stddev.value
         self._beam_area = 2*np.pi*x_stddev*y_stddev
         self._beam_kernel = beam_kernel
+        self._beam_fft = {} #Kernel FFTs, one per image shape
 
     @beam_kernel.deleter 
     def beam_kernel(self): 
@@ -1238,6 +1493,22 @@ class Intensity:
         print('Deleting use_full_channel var') 
         del self._use_full_channel
 
+    @property
+    def use_profile_table(self):
+        return getattr(self, '_use_profile_table', False)
+
+    @use_profile_table.setter 
+    def use_profile_table(self, use): 
+        use = bool(use)
+        print('Setting use_profile_table var to', use)
+        self._profile_tables = {}
+        self._use_profile_table = use
+
+    @use_profile_table.deleter 
+    def use_profile_table(self): 
+        print('Deleting use_profile_table var') 
+        del self._use_profile_table
+
     @property
     def line_profile(self): 
         return self._line_profile
@@ -1354,6 +1625,74 @@ class Intensity:
         J = J * dvsub/channel_width
         return J
 
+    def _get_beam_fft(self, shape):
+        """
+        Returns the FFT of the normalised beam kernel zero-padded to the linear-convolution size of an image of the input shape,
+        computed once per image shape. The padded workspace of the cube is allocated by each convolve_beam call.
+        """
+        from scipy import fft
+        if shape not in self._beam_fft:
+            kernel = np.asarray(self.beam_kernel.array, dtype=float)
+            kernel = kernel / kernel.sum()
+            ky, kx = kernel.shape
+            fshape = (fft.next_fast_len(shape[0] + ky - 1, real=True), fft.next_fast_len(shape[1] + kx - 1, real=True))
+            kernel_fft = fft.rfft2(kernel, s=fshape)
+            self._beam_fft[shape] = {'kernel_fft': kernel_fft, 'fshape': fshape, 'offset': (ky//2, kx//2)}
+        return self._beam_fft[shape]
+
+    def convolve_beam(self, cube, workers=None):
+        """
+        Convolves the channel maps with the beam_kernel and scales them by the beam area.
+
+        Follows the masking semantics of the direct approach: infinite pixels (i.e. model pixels with no emission) 
+        are set to zero, the image is padded with zeros and nan pixels are interpolated from their neighbours 
+        (astropy.convolution.convolve with the default nan_treatment='interpolate' and preserve_nan=False).
+
+        If beam_conv_method is 'fft' (default), the whole cube is convolved in one batched FFT pass using the kernel FFT 
+        cached for the image shape. Otherwise, astropy.convolution.convolve is invoked on each channel.
+        Validated against the direct approach on a 60x201x201 cube (7x5 pixels beam): without nan pixels the two methods 
+        agree to within 1e-14 times the cube peak. Pixels interpolated inside nan regions larger than the beam,
+        where the normalisation weights are small, agree to within 1e-9 times the cube peak.
+
+        Parameters
+        ----------
+        cube : array_like, shape (nchan, ny, nx) or (ny, nx)
+
+        workers : int, optional
+           Number of threads for the FFT. Defaults to None, i.e. a single thread.
+
+        Returns
+        -------
+        cube : `numpy.ndarray`, same shape as input.
+        """
+        from scipy import fft
+        cube = np.asarray(cube, dtype=float)
+        single = cube.ndim == 2
+        if single: cube = cube[None]
+        cube = np.where(np.isinf(cube), 0.0, cube)
+
+        if self.beam_conv_method != 'fft':
+            out = np.array([self._beam_area*convolve(chan, self.beam_kernel, preserve_nan=False) for chan in cube])
+            return out[0] if single else out
+
+        nchan, ny, nx = cube.shape
+        beam_fft = self._get_beam_fft((ny, nx))
+        fshape, (oy, ox) = beam_fft['fshape'], beam_fft['offset']
+        work = np.zeros((nchan,) + fshape) #Per call: released on return and private to the calling thread
+
+        nan_mask = np.isnan(cube)
+        work[:, :ny, :nx] = np.where(nan_mask, 0.0, cube)
+        out = fft.irfft2(fft.rfft2(work, axes=(-2,-1), workers=workers) * beam_fft['kernel_fft'], s=fshape, axes=(-2,-1), workers=workers)
+        out = out[:, oy:oy+ny, ox:ox+nx]
+        
+        if nan_mask.any(): #Kernel weight over valid pixels; the zero padding counts as valid, as in the direct approach
+            work[:, :ny, :nx] = nan_mask
+            norm = 1 - fft.irfft2(fft.rfft2(work, axes=(-2,-1), workers=workers) * beam_fft['kernel_fft'], s=fshape, axes=(-2,-1), workers=workers)[:, oy:oy+ny, ox:ox+nx]
+            with np.errstate(invalid='ignore', divide='ignore'): out = np.where(norm > 1e-8, out / norm, np.nan)
+        
+        out *= self._beam_area
+        return out[0] if single else out
+
     def get_line_profile(self, v_chan, vel2d, linew2d, lineb2d, **kwargs):
         if self.subpixels:
             v_near, v_far = [], []
@@ -1392,22 +1731,128 @@ class Intensity:
         #vmap_full = np.array([v_near_clean, v_far_clean]).max(axis=0)
         int2d_full = np.array([int2d_near, int2d_far]).max(axis=0)
         
-        if self.beam_kernel:
-            inf_mask = np.isinf(int2d_full)
-            int2d_full = np.where(inf_mask, 0.0, int2d_full) 
-            int2d_full = self._beam_area*convolve(int2d_full, self.beam_kernel, preserve_nan=False)
+        if self.beam_kernel: int2d_full = self.convolve_beam(int2d_full)
 
         return int2d_full
 
-    #def get_cube(self, vchan0, vchan1, velocity2d, intensity2d, linewidth2d, lineslope2d, nchan=30, tb={'nu': False, 'beam': False}, **kwargs):
-    def get_cube(self, vchannels, velocity2d, intensity2d, linewidth2d, lineslope2d, 
-                 nchan=None, tb={'nu': False, 'beam': False}, return_data_only=False, **kwargs):
-        vel2d, int2d, linew2d, lineb2d = velocity2d, {}, {}, {}
+    def _get_profile_table(self, key, func, **kwargs_table):
+        """
+        Returns the ProfileTable of func for the current profile_table_tol, building it on first use. 
+        Keeps up to 16 tables (e.g. one per line slope value during an mcmc run).
+        """
+        key = key + (self.profile_table_tol,)
+        with self._profile_tables_lock:
+            tables = self.__dict__.setdefault('_profile_tables', {})
+            if key not in tables:
+                if len(tables) >= 16: tables.pop(next(iter(tables)))
+                tables[key] = ProfileTable(func, tol=self.profile_table_tol, **kwargs_table)
+            return tables[key]
+
+    def _tabulated_profile(self, vchannels, v, linew, lineb, out=None, **kwargs):
+        """
+        Line profile looked up from a ProfileTable of u = |v - v_chan| / v_sigma, and of channel_width / v_sigma for the _full profiles. 
+        The bell profiles are tabulated for uniform line slopes only, one table per slope value. The 2D table of 
+        line_profile_bell_full takes ~0.5 s to build, it pays off for fixed slopes rather than when fitting them.
+        Returns None if the current profile and inputs are not tabulated.
+        """
         line_profile = self.line_profile
-        if nchan is None: nchan=len(vchannels)
-        #channels = np.linspace(vchan0, vchan1, num=nchan)
-        cube = []
+        full = line_profile in [Intensity.line_profile_bell_full, Intensity.line_profile_v_sigma_full, Intensity.line_profile_temp_full]
+        if line_profile in [Intensity.line_profile_temp_full, Intensity.line_profile_temp]:
+            v_turb, mmol = kwargs.get('v_turb', 0.0), kwargs.get('mmol', 2*sfu.amu)
+            linew = np.sqrt(kb*linew/mmol + v_turb**2) * 1e-3
+        t = kwargs.get('channel_width', 0.1) / linew if full else None
+        bell = line_profile in [Intensity.line_profile_bell, Intensity.line_profile_bell_full]
+        if bell:
+            if np.ndim(lineb) == 0: b = b_max = lineb
+            elif np.isnan(lineb).all(): return None
+            else: b, b_max = np.nanmin(lineb), np.nanmax(lineb) #Maps of constant slope are nan outside the disc
+            if b != b_max: return None
+            b = float(b)
+
+        if line_profile is Intensity.line_profile_bell:
+            table = self._get_profile_table(('bell', b), lambda u: Intensity.line_profile_bell(0, u, 1, b))
+        elif line_profile is Intensity.line_profile_bell_full:
+            table = self._get_profile_table(('bell_full', b), lambda u, w: Intensity.line_profile_bell_full(0, u, 1, b, channel_width=np.maximum(w, 1e-12)), 
+                                            t_range=self.profile_table_widths)
+        elif line_profile in [Intensity.line_profile_v_sigma_full, Intensity.line_profile_temp_full]:
+            table = self._get_profile_table(('v_sigma_full',), lambda u, w: Intensity.line_profile_v_sigma_full(0, u, 1, None, channel_width=np.maximum(w, 1e-12)), 
+                                            t_range=self.profile_table_widths)
+        else: return None #The gaussians (vectorised exp) are as cheap as the lookup
+        if t is not None and not table.in_range(t): return None
+
+        prof = table(np.subtract(v, vchannels, out=out), linew, t, out=out)
+        bad = np.isnan(v) | np.isnan(linew)
+        if bell: bad |= np.isnan(lineb)
+        if t is not None: bad |= np.isnan(t)
+        if np.any(bad): np.copyto(prof, np.nan, where=bad)
+        return prof
+
+    def _fused_profile(self, vchannels, v, linew, lineb, out=None, **kwargs):
+        """
+        Evaluates the line profile at all the channels at once, reusing a single output buffer (``out`` if provided). 
+        vchannels must be broadcastable against v. Only for line_profile_bell, line_profile_v_sigma and line_profile_temp,
+        and their _full variants if use_profile_table is on.
+        """
+        if self.use_profile_table:
+            prof = self._tabulated_profile(vchannels, v, linew, lineb, out=out, **kwargs)
+            if prof is not None: return prof
+        line_profile = self.line_profile
+        if line_profile in [Intensity.line_profile_bell_full, Intensity.line_profile_v_sigma_full, Intensity.line_profile_temp_full]:
+            return line_profile(vchannels, v, linew, lineb, **kwargs)
+        if line_profile is Intensity.line_profile_bell: 
+            prof = np.subtract(v, vchannels, out=out)
+            prof /= linew
+            np.abs(prof, out=prof)
+            np.power(prof, 2*lineb, out=prof)
+            prof += 1
+            return np.divide(1, prof, out=prof)
+        else:
+            if line_profile is Intensity.line_profile_temp:
+                v_turb, mmol = kwargs.get('v_turb', 0.0), kwargs.get('mmol', 2*sfu.amu)
+                linew = np.sqrt(kb*linew/mmol + v_turb**2) * 1e-3
+            prof = np.subtract(v, vchannels, out=out)
+            prof /= linew
+            np.power(prof, 2, out=prof)
+            prof *= -0.5
+            return np.exp(prof, out=prof)
+
+    def _get_cube_rows(self, rows, vchannels, vel2d, int2d, linew2d, lineb2d, masks, out=None, **kwargs):
+        """
+        Fused kernel: all channels, subpixels and both sides of the pixel rows in the slice ``rows``, in one pass.
+        Reproduces the operations of the per-channel loop in get_cube element by element.
+        ``out`` may provide three scratch buffers of shape (nchan, nrows, nx) to avoid allocations.
+        """
+        get_rows = lambda a: a if np.ndim(a) == 0 else a[rows]
+        vchan = vchannels[:,None,None]
+        if out is None: out = [None]*3
+        int_side = []
+        for n, side in enumerate(['near', 'far']):
+            linew, lineb = get_rows(linew2d[side]), get_rows(lineb2d[side])
+            if self.subpixels:
+                prof = self._fused_profile(vchan, vel2d[0][side][rows], linew, lineb, out=out[n], **kwargs)
+                for i in range(1, self.subpixels_sq): prof += self._fused_profile(vchan, vel2d[i][side][rows], linew, lineb, out=out[2], **kwargs)
+                prof *= self.sub_dA / self.pix_dA
+            else: prof = self._fused_profile(vchan, vel2d[side][rows], linew, lineb, out=out[n], **kwargs)
+            vel_nan, int_nan = get_rows(masks['vel_'+side]), get_rows(masks['int_'+side])
+            np.copyto(prof, -np.inf, where=vel_nan)
+            prof *= get_rows(int2d[side])
+            np.copyto(prof, -np.inf, where=int_nan)
+            int_side.append(prof)
+        return np.maximum(int_side[0], int_side[1], out=int_side[0])
+
+    def _get_row_blocks(self, nchan, nthreads=1, max_size=2**18):
+        """
+        Splits the sky grid rows into blocks of at most max_size (channel, pixel) elements, and at least one block per thread.
+        """
+        ny, nx = self.mesh[0].shape
+        nrows = int(np.clip(max_size // (nchan*nx), 1, max(1, -(-ny//nthreads))))
+        return [slice(r, min(r+nrows, ny)) for r in range(0, ny, nrows)]
 
+    def _get_cube_inputs(self, velocity2d, intensity2d, linewidth2d, lineslope2d):
+        """
+        Expands scalar inputs into near/far dicts and computes the nan masks of the velocity and intensity maps.
+        """
+        vel2d, int2d, linew2d, lineb2d = velocity2d, {}, {}, {}
         if isinstance(intensity2d, numbers.Number): int2d['near'] = int2d['far'] = intensity2d
         else: int2d = intensity2d
         if isinstance(linewidth2d, numbers.Number): linew2d['near'] = linew2d['far'] = linewidth2d
@@ -1415,19 +1860,49 @@ class Intensity:
         if isinstance(lineslope2d, numbers.Number): lineb2d['near'] = lineb2d['far'] = lineslope2d
         else: lineb2d = lineslope2d
 
-        int2d_near_nan = np.isnan(int2d['near'])#~int2d['near'].mask#
-        int2d_far_nan = np.isnan(int2d['far'])#~int2d['far'].mask#
+        masks = {'int_near': np.isnan(int2d['near']), 'int_far': np.isnan(int2d['far'])}
         if self.subpixels:
-            vel2d_near_nan = np.isnan(vel2d[self.sub_centre_id]['near'])
-            vel2d_far_nan = np.isnan(vel2d[self.sub_centre_id]['far'])
+            masks['vel_near'] = np.isnan(vel2d[self.sub_centre_id]['near'])
+            masks['vel_far'] = np.isnan(vel2d[self.sub_centre_id]['far'])
         else:
-            vel2d_near_nan = np.isnan(vel2d['near'])#~vel2d['near'].mask#
-            vel2d_far_nan = np.isnan(vel2d['far'])#~vel2d['far'].mask#
+            masks['vel_near'] = np.isnan(vel2d['near'])
+            masks['vel_far'] = np.isnan(vel2d['far'])
+        return vel2d, int2d, linew2d, lineb2d, masks
+
+    @property
+    def _has_fused_profile(self):
+        profiles = [Intensity.line_profile_bell, Intensity.line_profile_v_sigma, Intensity.line_profile_temp]
+        if self.use_profile_table: profiles += [Intensity.line_profile_bell_full, Intensity.line_profile_v_sigma_full, Intensity.line_profile_temp_full]
+        return self.line_profile in profiles
+
+    def _get_cube_fused(self, vchannels, vel2d, int2d, linew2d, lineb2d, masks, nthreads=None, max_size=2**18, **kwargs):
+        """
+        Unconvolved channel maps computed by the fused kernel, multi-threaded across blocks of pixel rows.
+        """
+        from concurrent.futures import ThreadPoolExecutor
+        vchannels = np.asarray(vchannels, dtype=float)
+        ny, nx = self.mesh[0].shape
+        nthreads = os.cpu_count() if nthreads is None else nthreads
+        blocks = self._get_row_blocks(len(vchannels), nthreads, max_size=max_size)
+        cube = np.empty((len(vchannels), ny, nx))
+        def run(rows): cube[:,rows] = self._get_cube_rows(rows, vchannels, vel2d, int2d, linew2d, lineb2d, masks, **kwargs)
+        if nthreads > 1 and len(blocks) > 1:
+            with ThreadPoolExecutor(max_workers=nthreads) as executor: list(executor.map(run, blocks))
+        else: 
+            for rows in blocks: run(rows)
+        return cube
 
+    def _get_cube_loop(self, vchannels, vel2d, int2d, linew2d, lineb2d, masks, **kwargs):
+        """
+        Unconvolved channel maps computed channel by channel, for the profiles without a fused kernel.
+        """
+        cube = []
+        int2d_near_nan, int2d_far_nan = masks['int_near'], masks['int_far']
+        vel2d_near_nan, vel2d_far_nan = masks['vel_near'], masks['vel_far']
         #for i, v_chan in enumerate(vchannels):
         #viter = iter(vchannels)
         #for _ in itertools.repeat(None, nchan):
-        for i in range(nchan):
+        for i in range(len(vchannels)):
             v_near, v_far = self.get_line_profile(vchannels[i], vel2d, linew2d, lineb2d, **kwargs)
             v_near_clean = np.where(vel2d_near_nan, -np.inf, v_near)
             v_far_clean = np.where(vel2d_far_nan, -np.inf, v_far)
@@ -1437,15 +1912,72 @@ class Intensity:
             #vmap_full = np.array([v_near_clean, v_far_clean]).max(axis=0)
             int2d_full = np.array([int2d_near, int2d_far]).max(axis=0)
 
-            if self.beam_kernel:
-                inf_mask = np.isinf(int2d_full)
-                int2d_full = np.where(inf_mask, 0.0, int2d_full)
-                int2d_full = self._beam_area*convolve(int2d_full, self.beam_kernel, preserve_nan=False)
-
             cube.append(int2d_full)
-            
-        if return_data_only: return np.asarray(cube)
-        else: return Cube(nchan, vchannels, np.asarray(cube), beam=self.beam_info, beam_kernel=self.beam_kernel, tb=tb)
+        return np.asarray(cube)
+
+    def _get_cube_block(self, vchannels, vel2d, int2d, linew2d, lineb2d, masks, nthreads=None, **kwargs):
+        """
+        Channel maps at the velocities vchannels, convolved with the beam if any.
+        """
+        if self._has_fused_profile: cube = self._get_cube_fused(vchannels, vel2d, int2d, linew2d, lineb2d, masks, nthreads=nthreads, **kwargs)
+        else: cube = self._get_cube_loop(vchannels, vel2d, int2d, linew2d, lineb2d, masks, **kwargs)
+        if self.beam_kernel: cube = self.convolve_beam(cube, workers=nthreads)
+        return cube
+
+    def _write_cube(self, output, vchannels, inputs, tb={'nu': False, 'beam': False}, nthreads=None, kw_header={}, **kwargs):
+        """
+        Computes the cube in blocks of channels and writes them into a pre-allocated, memory-mapped FITS file.
+        """
+        ny, nx = self.mesh[0].shape
+        nchan = len(vchannels)
+        header = dict(kw_header)
+        dv = np.diff(vchannels)
+        if nchan > 1 and np.allclose(dv, dv[0]):
+            for key, val in [('CRVAL3', vchannels[0]), ('CDELT3', dv[0]), ('CRPIX3', 1)]: header.setdefault(key, val)
+        data = Tools.make_fits_memmap(output, (nchan, ny, nx), dtype=np.float32, **header)
+        nblock = int(max(1, self.stream_block_size // (ny*nx)))
+        for c in range(0, nchan, nblock):
+            block = self._get_cube_block(vchannels[c:c+nblock], *inputs, nthreads=nthreads, **kwargs)
+            if isinstance(tb, dict) and tb['nu'] and tb['beam']: block = Tools._get_tb(block, tb['nu'], tb['beam'])
+            data[c:c+nblock] = np.where(np.isfinite(block), block, 0)
+        data.flush()
+        del data
+        print ('Cube written into %s'%output)
+
+    #def get_cube(self, vchan0, vchan1, velocity2d, intensity2d, linewidth2d, lineslope2d, nchan=30, tb={'nu': False, 'beam': False}, **kwargs):
+    def get_cube(self, vchannels, velocity2d, intensity2d, linewidth2d, lineslope2d, 
+                 nchan=None, tb={'nu': False, 'beam': False}, return_data_only=False, nthreads=None, 
+                 output=None, kw_header={}, **kwargs):
+        """
+        Computes the channel maps of the model at the velocities ``vchannels``.
+
+        For the line_profile_bell, line_profile_v_sigma and line_profile_temp profiles, all the channels and subpixels
+        are evaluated by a fused kernel running on ``nthreads`` threads across blocks of pixel rows (defaults to the number of cpus).
+        Other profiles are evaluated channel by channel.
+
+        If use_profile_table is on, line_profile_bell and the _full profiles (including line_profile_bell_full and 
+        line_profile_temp_full, which are then evaluated by the fused kernel too) are looked up from precomputed tables 
+        (see `ProfileTable`), with an absolute error below profile_table_tol. Non-uniform line slopes and 
+        channel_width / v_sigma ratios outside profile_table_widths fall back to the exact profiles.
+
+        If ``output`` is a path, the cube is not held in memory: blocks of at most stream_block_size (channel, pixel) elements 
+        are computed, convolved and written into a pre-allocated FITS file (float32, non-finite values set to 0 as in `Cube.make_fits`, 
+        header cards from ``kw_header`` plus CRVAL3, CDELT3 and CRPIX3 for uniform channels), which is returned as a 
+        memory-mapped `Cube` (see `Cube.from_fits`), or as its memory-mapped data if return_data_only.
+        """
+        if nchan is None: nchan=len(vchannels)
+        #channels = np.linspace(vchan0, vchan1, num=nchan)
+        inputs = self._get_cube_inputs(velocity2d, intensity2d, linewidth2d, lineslope2d)
+
+        if output is not None:
+            self._write_cube(output, vchannels[:nchan], inputs, tb=tb, nthreads=nthreads, kw_header=kw_header, **kwargs)
+            cube = Cube.from_fits(output, channels=vchannels[:nchan], beam=self.beam_info, beam_kernel=self.beam_kernel)
+            if return_data_only: return cube.data
+            else: return cube
+
+        cube = self._get_cube_block(vchannels[:nchan], *inputs, nthreads=nthreads, **kwargs)
+        if return_data_only: return cube
+        else: return Cube(nchan, vchannels, cube, beam=self.beam_info, beam_kernel=self.beam_kernel, tb=tb)
 
     @staticmethod
     def make_channels_movie(vchan0, vchan1, velocity2d, intensity2d, linewidth2d, nchans=30, folder='./movie_channels/', **kwargs):
@@ -1564,25 +2096,92 @@ class Mcmc:
         corner.corner(samples, labels=labels, title_fmt='.4f', bins=30,
                       quantiles=quantiles, show_titles=True)
         
-    def ln_likelihood(self, new_params, **kwargs):
+    def _set_likelihood_data(self, data, noise_stddev):
+        """
+        Precomputes the data-side quantities of the likelihood and resets the scratch buffers.
+        """
+        if hasattr(self, '_mc_map_pool'): self.close_map_pool() #Its workers hold the former data and noise
+        self.data = data
+        self.noise_stddev = noise_stddev
+        self._mc_data_src = data
+        self._mc_data = np.asarray(data, dtype=float)
+        self._mc_data_mask = np.isfinite(self._mc_data)
+        self._mc_noise = np.asarray(noise_stddev, dtype=float)
+        self._mc_scratch = {}
+
+    def __getstate__(self):
+        #Thread pools cannot be pickled (pool backend, copies of the model); each copy starts its own pool and buffers
+        state = dict(self.__dict__)
+        state.pop('_mc_executor', None)
+        state.pop('_mc_map_pool', None)
+        state['_mc_scratch'] = {}
+        return state
+
+    def _get_executor(self, nthreads):
+        """
+        Thread pool of the chi-square blocks, kept by the instance across ln_likelihood calls. 
+        Its threads live as long as the pool, hence the scratch buffers, one set per thread, are allocated only once.
+        """
+        from concurrent.futures import ThreadPoolExecutor
+        nthreads_pool, executor = getattr(self, '_mc_executor', (None, None))
+        if nthreads_pool != nthreads:
+            if executor is not None: executor.shutdown()
+            executor = ThreadPoolExecutor(max_workers=nthreads)
+            self._mc_executor = (nthreads, executor)
+            self._mc_scratch = {} #Drops the buffers of the former threads
+        return executor
+
+    def _get_scratch(self, shape, n=1, dtype=float):
+        key = (shape, n, np.dtype(dtype).str, threading.get_ident())
+        if key not in self._mc_scratch: self._mc_scratch[key] = [np.empty(shape, dtype=dtype) for i in range(n)]
+        return self._mc_scratch[key]
+
+    def _get_chi2(self, model, rows=slice(None)):
+        """
+        Sum of squared residuals between the model channels and the data, over the pixels where both are finite, for the sky rows ``rows``.
+        """
+        res, = self._get_scratch(model.shape)
+        mask, = self._get_scratch(model.shape, dtype=bool)
+        nchan = len(model)
+        with np.errstate(invalid='ignore', over='ignore'): #Non-finite residuals are masked out below
+            np.subtract(self._mc_data[:nchan,rows], model, out=res)
+            res /= self._mc_noise if self._mc_noise.ndim < 2 else self._mc_noise[...,rows,:]
+            np.square(res, out=res)
+        np.isfinite(model, out=mask)
+        mask &= self._mc_data_mask[:nchan,rows]
+        return np.sum(res, where=mask)
+
+    def _set_params(self, new_params):
+        """
+        Writes the parameter vector into self.params. Returns False if any parameter is out of its boundaries.
+        """
         for i in range(self.mc_nparams):
-            if not (self.mc_boundaries_list[i][0] < new_params[i] < self.mc_boundaries_list[i][1]): return -np.inf
+            if not (self.mc_boundaries_list[i][0] < new_params[i] < self.mc_boundaries_list[i][1]): return False
             else: self.params[self.mc_kind[i]][self.mc_header[i]] = new_params[i]
+        return True
 
-        vel2d, int2d, linew2d, lineb2d = self.make_model(**kwargs)
+    def ln_likelihood(self, new_params, **kwargs):
+        if not self._set_params(new_params): return -np.inf
 
-        lnx2=0    
-        model_cube = self.get_cube(self.channels, vel2d, int2d, linew2d, lineb2d, nchan=self.nchan, return_data_only=True)#, tb = {'nu': 230, 'beam': self.beam_info})
-        for i in range(self.nchan):
-            model_chan = model_cube[i] #model_cube.data[i] #self.get_channel(vel2d, int2d, linew2d, lineb2d, self.channels[i])
-            mask_data = np.isfinite(self.data[i])
-            mask_model = np.isfinite(model_chan)
-            data = np.where(np.logical_and(mask_model, ~mask_data), 0, self.data[i])
-            model = np.where(np.logical_and(mask_data, ~mask_model), 0, model_chan)
-            mask = np.logical_and(mask_data, mask_model)
-            lnx =  np.where(mask, np.power((data - model)/self.noise_stddev, 2), 0) 
-            #lnx = -0.5 * np.sum(lnx2[~np.isnan(lnx2)] * 0.00001)# * self.ivar)
-            lnx2 += -0.5 * np.sum(lnx)
+        vel2d, int2d, linew2d, lineb2d = self.make_model(**kwargs)
+        if getattr(self, '_mc_data_src', None) is not self.data: self._set_likelihood_data(self.data, self.noise_stddev)
+
+        nthreads = getattr(self, '_mc_nthreads', 1)
+        if self._has_fused_profile and not self.beam_kernel:
+            #Channels are streamed from the fused cube kernel into the chi-square reduction, block of rows by block of rows
+            vel2d, int2d, linew2d, lineb2d, masks = self._get_cube_inputs(vel2d, int2d, linew2d, lineb2d)
+            vchannels = np.asarray(self.channels[:self.nchan], dtype=float)
+            def chi2_block(rows):
+                nrows = len(range(*rows.indices(self.mesh[0].shape[0])))
+                out = self._get_scratch((self.nchan, nrows, self.mesh[0].shape[1]), n=3)
+                model = self._get_cube_rows(rows, vchannels, vel2d, int2d, linew2d, lineb2d, masks, out=out)
+                return self._get_chi2(model, rows)
+            blocks = self._get_row_blocks(self.nchan, nthreads)
+            if nthreads > 1: lnx2 = -0.5 * np.sum(list(self._get_executor(nthreads).map(chi2_block, blocks)))
+            else: lnx2 = -0.5 * np.sum([chi2_block(rows) for rows in blocks])
+        else:
+            model_cube = self.get_cube(self.channels, vel2d, int2d, linew2d, lineb2d, nchan=self.nchan, return_data_only=True, nthreads=nthreads)#, tb = {'nu': 230, 'beam': self.beam_info})
+            lnx2 = -0.5 * self._get_chi2(model_cube)
             
         #print (new_params, "\nLOG LIKELIHOOD %.4e"%lnx2)
         return lnx2 if np.isfinite(lnx2) else -np.inf
@@ -1617,6 +2216,8 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
         self.R_true = hypot_func(x_true, y_true) #grid.rRTP[1] #Slightly different as in the grid object the pixels R=0 actually take the closest-neighbour value. Current approach masks r,R=0
         self.x_true, self.y_true = x_true, y_true
         self.mesh = np.meshgrid(skygrid.XYZgrid[0], skygrid.XYZgrid[1]) #disc grid will be interpolated onto this sky grid in make_model(). Must match data dims for mcmc. 
+        self._sky_operators = {} #Interpolation operators onto the sky grid, one per projected (incl, PA, z-surface) layout
+        self._sky_operators_max = 8
 
         if subpixels and isinstance(subpixels, int):
             if subpixels%2 == 0: subpixels+=1 #If input even becomes odd to contain pxl centre
@@ -1690,11 +2291,29 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
     def run_mcmc(self, data, channels, p0_mean='optimize', p0_stddev=1e-3, noise_stddev=1.0,
                  nwalkers=30, nsteps=100, frac_stats=0.5, frac_stddev=1e-3, mc_layers=1, z_mirror=False, 
                  custom_header={}, custom_kind={}, tag='',
-                 plot_walkers=True, plot_corner=True, **kwargs_model): #p0 from 'optimize', 'min', 'max', list of values.
-        self.data = data
+                 plot_walkers=True, plot_corner=True, 
+                 backend='pool', nprocesses=None, nthreads=1, 
+                 coarse_steps=0, kwargs_coarse={}, **kwargs_model): #p0 from 'optimize', 'min', 'max', list of values.
+        """
+        Fits the model to the data cube with the emcee sampler.
+
+        The walkers are evaluated in parallel by a pool of ``nprocesses`` processes (defaults to the number of cpus), 
+        each one running ``nthreads`` threads in the cube kernel and the beam convolution (defaults to 1).
+
+        If backend='pool' (default), the model instance is sent to the processes of a standard multiprocessing Pool on each step.
+        If backend='shared', the data cube and the sky grid arrays are placed in shared memory and mapped by 
+        persistent worker processes, which receive the model instance once at start-up and keep their cached projection operators 
+        for the whole run; only the walker parameters and likelihoods travel between processes. 
+        It needs multiprocessing.shared_memory (Python >= 3.8), otherwise the 'pool' backend is used.
+
+        If coarse_steps > 0, the walkers first run coarse_steps steps on a reduced version of the problem (see `get_coarse_model`, 
+        which takes the ``kwargs_coarse``), and then nsteps steps at full resolution starting from their last coarse positions. 
+        The speed-up per likelihood evaluation and the shift of the coarse medians with respect to the full-resolution ones 
+        (in units of the full-resolution 68.2% errors) are printed and stored in the attribute ``multires_report``.
+        """
         self.channels = channels
         self.nchan = len(channels)
-        self.noise_stddev = noise_stddev
+        self._set_likelihood_data(data, noise_stddev)
 
         kwargs_model.update({'z_mirror': z_mirror})
         if z_mirror: 
@@ -1724,13 +2343,15 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
                               size=(nwalkers, ndim)
                               )
 
-        with Pool() as pool:
-            sampler = emcee.EnsembleSampler(nwalkers, ndim, self.ln_likelihood, pool=pool, kwargs=kwargs_model)                                                        
-            start = time.time()
-            sampler.run_mcmc(p0, nsteps, progress=True)
-            end = time.time()
-            multi_time = end - start
-            print("Multiprocessing took {0:.1f} seconds".format(multi_time))
+        kwargs_sampler = dict(backend=backend, nprocesses=nprocesses, nthreads=nthreads, kwargs_model=kwargs_model)
+        if coarse_steps > 0:
+            coarse = self.get_coarse_model(**kwargs_coarse)
+            print ('Running %d coarse steps with factor=%d, chan_step=%d'%(coarse_steps, coarse._coarse_factor, coarse._coarse_chan_step))
+            sampler_coarse = coarse._run_sampler(p0, coarse_steps, **kwargs_sampler)
+            p0 = sampler_coarse.chain[:, -1]
+            print ('Switching to full resolution')
+
+        sampler = self._run_sampler(p0, nsteps, **kwargs_sampler)
 
         samples = sampler.chain[:, -nstats:] #3d matrix, shape (nwalkers, nstats, npars)
         samples = samples.reshape(-1, samples.shape[-1]) #2d matrix, shape (nwalkers*nstats, npars). With the -1 np guesses the dimensionality
@@ -1751,6 +2372,11 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
         self.best_params_errpos = np.asarray(errpos).squeeze()
         self.best_params_errneg = np.asarray(errneg).squeeze()
 
+        if coarse_steps > 0: 
+            nstats_coarse = int(round(frac_stats*(coarse_steps-1)))
+            samples_coarse = sampler_coarse.chain[:, -nstats_coarse:].reshape(-1, ndim)
+            self.multires_report = self._get_multires_report(coarse, np.median(samples_coarse, axis=0), kwargs_model)
+
         #************
         #PLOTTING
         #************
@@ -1762,14 +2388,311 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
             plt.savefig('mc_corner_%s_%dwalkers_%dsteps.png'%(tag, nwalkers, nsteps))
             plt.close()
 
+    def _map_chunk(self, kind, params_list, **kwargs_model):
+        out = []
+        for new_params in params_list:
+            if kind == 'ln_likelihood': out.append(self.ln_likelihood(new_params, **kwargs_model))
+            elif not self._set_params(new_params): out.append(np.full((self.nchan,) + self.mesh[0].shape, np.nan))
+            else:
+                vel2d, int2d, linew2d, lineb2d = self.make_model(**kwargs_model)
+                out.append(self.get_cube(self.channels, vel2d, int2d, linew2d, lineb2d, nchan=self.nchan, return_data_only=True, nthreads=getattr(self, '_mc_nthreads', 1)))
+        return out
+
+    def map_params(self, params_list, channels=None, kind='ln_likelihood', data=None, noise_stddev=1.0, 
+                   nprocesses=1, nthreads=1, **kwargs_model):
+        """
+        Maps the model over a list of parameter vectors, e.g. all the walkers of an emcee step or a grid scan.
+
+        This is a pooled map: each vector is evaluated on its own by ln_likelihood (or make_model and get_cube), 
+        there is no vectorization across the vectors. The list is split into contiguous chunks evaluated by ``nprocesses`` 
+        processes (see run_mcmc for the shared-memory pool) with ``nthreads`` threads each. The pool is kept by the instance 
+        and reused by the next calls, see `close_map_pool`. The vectors are sorted by their orientation and height parameters 
+        first, so that in grid scans the vectors repeating the same geometry run one after another and reuse the cached 
+        stages of make_model; continuous walker positions do not share any geometry.
+
+        Parameters
+        ----------
+        params_list : array_like, shape (nvectors, mc_nparams)
+           Parameter vectors, ordered as mc_header. Vectors out of the mc_boundaries get a -inf log-likelihood (or a nan cube).
+
+        channels : array_like, optional
+           Velocity channels. Defaults to None, i.e. those set by the last run_mcmc or map_params call.
+
+        kind : 'ln_likelihood' or 'cube', optional
+           Output of each model. Defaults to 'ln_likelihood'.
+
+        data, noise_stddev : array_like and scalar or array_like, optional
+           Data cube and noise for the likelihood. Defaults to None, i.e. the data of the last run_mcmc or map_params call.
+
+        nprocesses : int, optional
+           Number of processes. More than one needs multiprocessing.shared_memory (Python >= 3.8), 
+           otherwise the vectors are evaluated in this process. Defaults to 1.
+
+        kwargs_model : 
+           Keyword arguments for make_model, e.g. R_disc or z_mirror. As in run_mcmc, with z_mirror=True the height_lower 
+           parameters are taken from height_upper and drop out of the parameter vectors.
+
+        Returns
+        -------
+        out : `numpy.ndarray`, shape (nvectors,) or (nvectors, nchan, ny, nx)
+           Log-likelihoods or model cubes, in the order of the input vectors.
+
+        Examples
+        --------
+        Scan of the likelihood on a grid of stellar masses and inclinations, with the remaining parameters fixed to p0:
+
+        >>> Mstar, incl = np.meshgrid(np.linspace(0.5, 1.5, 21), np.linspace(0.4, 0.8, 21))
+        >>> params_list = np.tile(p0, (Mstar.size, 1))
+        >>> params_list[:,0], params_list[:,1] = Mstar.ravel(), incl.ravel()
+        >>> lnL = model.map_params(params_list, channels, data=data).reshape(Mstar.shape)
+        """
+        if kind not in ['ln_likelihood', 'cube']: raise InputError(kind, "kind must be 'ln_likelihood' or 'cube'")
+        if channels is not None: 
+            self.channels = channels
+            self.nchan = len(channels)
+        if data is not None: self._set_likelihood_data(data, noise_stddev)
+        mirror = kwargs_model.get('z_mirror', False) and any(val != 'height_upper' for val in self.mc_params['height_lower'].values())
+        if mirror: 
+            for key in self.mc_params['height_lower']: self.mc_params['height_lower'][key] = 'height_upper'
+        if not hasattr(self, 'params') or self.prototype or mirror: 
+            self.mc_header, self.mc_kind, self.mc_nparams, self.mc_boundaries_list, self.mc_params_indices = General2d._get_params2fit(self.mc_params, self.mc_boundaries)
+            if not hasattr(self, 'params') or mirror: self.params = copy.deepcopy(self.mc_params)
+        if nprocesses > 1 and not SharedArrays.available():
+            warnings.warn('multiprocessing.shared_memory is not available (Python < 3.8), evaluating the vectors in this process')
+            nprocesses = 1
+
+        params_list = np.atleast_2d(params_list)
+        geometry = [i for i in range(self.mc_nparams) if self.mc_kind[i] in ['orientation', 'height_upper', 'height_lower']]
+        order = np.lexsort(params_list[:, geometry[::-1]].T) if len(geometry) else np.arange(len(params_list))
+        chunks = [chunk for chunk in np.array_split(order, max(1, nprocesses)) if len(chunk)]
+
+        if nprocesses > 1:
+            pool = self._get_map_pool(nprocesses, nthreads)
+            res = pool.map(_mc_worker_map, [(kind, params_list[chunk], kwargs_model) for chunk in chunks])
+        else:
+            self._mc_nthreads = nthreads
+            res = [self._map_chunk(kind, params_list[chunk], **kwargs_model) for chunk in chunks]
+
+        out = [None]*len(params_list)
+        for chunk, vals in zip(chunks, res):
+            for i, val in zip(chunk, vals): out[i] = val
+        return np.asarray(out)
+
+    @staticmethod
+    def _fingerprint(val, max_size=2**16):
+        """
+        Hashable summary of an attribute value. Small arrays are hashed by content, large ones (e.g. the data cube) by identity.
+        """
+        import hashlib
+        if isinstance(val, np.ndarray): 
+            if val.size > max_size: return ('ndarray', id(val), val.shape, val.dtype.str)
+            return ('ndarray', val.shape, val.dtype.str, hashlib.sha1(np.ascontiguousarray(val).tobytes()).hexdigest())
+        if isinstance(val, dict): return ('dict',) + tuple((repr(k), General2d._fingerprint(v)) for k, v in sorted(val.items(), key=lambda kv: repr(kv[0])))
+        if isinstance(val, (list, tuple)): return (type(val).__name__,) + tuple(General2d._fingerprint(v) for v in val)
+        if val is None or isinstance(val, (numbers.Number, str)): return val
+        return (type(val).__name__, id(val)) #Functions, kernels, grids...
+
+    def _get_model_fingerprint(self):
+        """
+        Fingerprint of the state copied into the pool workers: all the public attributes (data, noise, channels, grids, 
+        model functions, line profile, beam...) and the fixed parameters. The fitted parameters are set on each evaluation.
+        """
+        fitted = set(zip(self.mc_kind, self.mc_header))
+        state = {key: val for key, val in self.__dict__.items() if not key.startswith('_') and key != 'params'}
+        state['params'] = {kind: {key: val for key, val in self.params[kind].items() if (kind, key) not in fitted} for kind in self.params}
+        return self._fingerprint(state)
+
+    def _get_map_pool(self, nprocesses, nthreads):
+        """
+        Shared-memory pool of map_params, kept by the instance across calls. The workers hold a copy of the model taken 
+        when the pool starts, so the pool is rebuilt if the pool size or any of the model attributes (see `_get_model_fingerprint`) change.
+        """
+        key = (nprocesses, nthreads, self._get_model_fingerprint())
+        cached = getattr(self, '_mc_map_pool', None)
+        if cached is not None and cached['key'] == key: return cached['pool']
+        self.close_map_pool()
+        shared = SharedArrays()
+        try: pool = self._get_shared_pool(shared, nprocesses=nprocesses, nthreads=nthreads)
+        except: 
+            shared.close()
+            raise
+        self._mc_map_pool = {'key': key, 'pool': pool, 'finalizer': weakref.finalize(self, _close_pool, pool, shared)} #Also closed at exit
+        return pool
+
+    def close_map_pool(self):
+        """
+        Stops the worker processes of map_params and releases their shared memory. The pool is also closed when the likelihood 
+        data are set, and rebuilt by map_params whenever the model changes; arrays larger than 2**16 elements are only tracked 
+        by identity, so call this after modifying one of them in place.
+        """
+        cached = self.__dict__.pop('_mc_map_pool', None)
+        if cached is not None: cached['finalizer']()
+
+    def _run_sampler(self, p0, nsteps, backend='pool', nprocesses=None, nthreads=1, kwargs_model={}):
+        nwalkers, ndim = np.shape(p0)
+        if backend == 'shared' and not SharedArrays.available():
+            warnings.warn("multiprocessing.shared_memory is not available (Python < 3.8), using backend='pool' instead")
+            backend = 'pool'
+        if backend == 'shared':
+            shared = SharedArrays()
+            try:
+                with self._get_shared_pool(shared, nprocesses=nprocesses, nthreads=nthreads) as pool:
+                    sampler = emcee.EnsembleSampler(nwalkers, ndim, _mc_worker_ln_likelihood, pool=pool, kwargs=kwargs_model)
+                    start = time.time()
+                    sampler.run_mcmc(p0, nsteps, progress=True)
+                    end = time.time()
+            finally: shared.close()
+        elif backend == 'pool':
+            self._mc_nthreads = nthreads
+            with Pool(processes=nprocesses) as pool:
+                sampler = emcee.EnsembleSampler(nwalkers, ndim, self.ln_likelihood, pool=pool, kwargs=kwargs_model)                                                        
+                start = time.time()
+                sampler.run_mcmc(p0, nsteps, progress=True)
+                end = time.time()
+        else: raise InputError(backend, "backend must be 'shared' or 'pool'")
+        multi_time = end - start
+        print("Multiprocessing took {0:.1f} seconds".format(multi_time))
+        return sampler
+
+    @staticmethod
+    def _block_mean(a, factor, axes):
+        """
+        Averages ``a`` over blocks of ``factor`` consecutive elements along ``axes``, ignoring nans. Trailing elements that do not fill a block are dropped.
+        """
+        a = np.asarray(a, dtype=float)
+        for axis in sorted(axes, reverse=True):
+            n = a.shape[axis] // factor
+            a = np.take(a, np.arange(n*factor), axis=axis)
+            a = a.reshape(a.shape[:axis] + (n, factor) + a.shape[axis+1:])
+            with warnings.catch_warnings():
+                warnings.simplefilter('ignore', category=RuntimeWarning) #All-nan blocks stay nan
+                a = np.nanmean(a, axis=axis+1)
+        return a
+
+    def get_coarse_model(self, factor=2, chan_step=1, noise_factor=None):
+        """
+        Returns a reduced copy of the model and of the fitted data, for the coarse stage of run_mcmc.
+
+        The disc grid, the sky grid and the data cube are block-averaged over factor x factor pixels, and only one every chan_step channels is kept.
+        The model is evaluated by the same make_model and get_cube machinery on the coarse grids; the beam kernel, if any, 
+        is shrunk by factor while keeping the beam area of the original pixels so that the model units do not change.
+
+        Parameters
+        ----------
+        factor : int, optional
+           Block size, in pixels. Defaults to 2.
+
+        chan_step : int, optional
+           Channel stride. Defaults to 1.
+
+        noise_factor : float, optional
+           The noise of the coarse data is the original one divided by noise_factor. 
+           Defaults to None: factor*sqrt(chan_step), i.e. averaging of independent pixel noise, plus a chan_step 
+           weighting of the kept channels so that the coarse likelihood carries roughly the same information as the original one.
+
+        Returns
+        -------
+        coarse : General2d
+        """
+        factor, chan_step = int(factor), int(chan_step)
+        coarse = copy.copy(self)
+        coarse.params = copy.deepcopy(self.params)
+        coarse._sky_operators = {}
+        coarse._stages = {} #The stage products of self live on the full-resolution grids
+        coarse.subpixels = False
+        
+        #Coarse disc grid
+        x_disc, y_disc = [self._block_mean(xc, factor, [0]) for xc in self.grid.XYZgrid[:2]]
+        x_true, y_true = [xy.flatten() for xy in np.meshgrid(x_disc, y_disc, indexing='ij')]
+        coarse.grid = copy.copy(self.grid)
+        coarse.grid.XYZgrid = [x_disc, y_disc] + list(self.grid.XYZgrid[2:])
+        coarse.grid.XYZ = [x_true, y_true, np.zeros_like(x_true)]
+        coarse.grid.step = np.asarray(self.grid.step) * factor
+        coarse.grid.NPoints = len(x_true)
+        coarse.x_true, coarse.y_true = x_true, y_true
+        coarse.phi_true = np.arctan2(y_true, x_true)
+        coarse.R_true = hypot_func(x_true, y_true)
+
+        #Coarse sky grid and data
+        x_sky = self._block_mean(self.mesh[0][0], factor, [0])
+        y_sky = self._block_mean(self.mesh[1][:,0], factor, [0])
+        coarse.mesh = np.meshgrid(x_sky, y_sky)
+        data = self._block_mean(np.asarray(self.data)[:self.nchan:chan_step], factor, [1,2])
+        if noise_factor is None: noise_factor = factor*np.sqrt(chan_step)
+        noise = np.asarray(self.noise_stddev, dtype=float)
+        if noise.ndim >= 2: noise = self._block_mean(noise, factor, [noise.ndim-2, noise.ndim-1])
+        if noise.ndim == 3: noise = noise[:self.nchan:chan_step]
+        coarse.channels = np.asarray(self.channels)[:self.nchan:chan_step]
+        coarse.nchan = len(coarse.channels)
+        coarse._set_likelihood_data(data, noise / noise_factor)
+
+        if self.beam_kernel:
+            model = self.beam_kernel.model
+            coarse._beam_kernel = Gaussian2DKernel(model.x_stddev.value/factor, model.y_stddev.value/factor, model.theta.value)
+            coarse._beam_fft = {}
+            coarse._beam_area = self._beam_area
+
+        coarse._coarse_factor, coarse._coarse_chan_step = factor, chan_step
+        return coarse
+
+    def _get_multires_report(self, coarse, coarse_params, kwargs_model={}, nevals=3):
+        """
+        Times the likelihood at both resolutions at the best-fit parameters, and compares the coarse and full-resolution medians.
+        """
+        times = {}
+        for level, model in [('coarse', coarse), ('full', self)]:
+            start = time.time()
+            for i in range(nevals): model.ln_likelihood(self.best_params, **kwargs_model)
+            times[level] = (time.time() - start) / nevals
+        err = 0.5*(np.atleast_1d(self.best_params_errpos) + np.atleast_1d(self.best_params_errneg))
+        with np.errstate(invalid='ignore', divide='ignore'): bias = (coarse_params - self.best_params) / err
+        report = {'factor': coarse._coarse_factor, 'chan_step': coarse._coarse_chan_step,
+                  'time_coarse': times['coarse'], 'time_full': times['full'], 'speedup': times['full']/times['coarse'],
+                  'coarse_params': coarse_params, 'full_params': self.best_params, 'bias': bias}
+        print ('Likelihood time per evaluation: %.3e s (coarse), %.3e s (full), speed-up: %.1f'%(times['coarse'], times['full'], report['speedup']))
+        print ('Coarse minus full-resolution medians, in units of the full-resolution errors:', list(zip(self.mc_header, bias)))
+        return report
+
+    _shared_attrs = ['data', '_mc_data', '_mc_data_mask', '_mc_noise', 'mesh', 'x_true', 'y_true', 'R_true', 'phi_true']
+
+    def _get_shared_pool(self, shared, nprocesses=None, nthreads=1):
+        """
+        Returns a Pool whose processes hold a copy of the model instance, with the large read-only arrays mapped from shared memory.
+        """
+        state = self.__getstate__()
+        state['_profile_tables'] = {} #Rebuilt on first use by each process
+        for key in self._shared_attrs:
+            val = state.get(key)
+            if isinstance(val, np.ndarray) and val.ndim > 0: state[key] = shared.share(val)
+            elif isinstance(val, list) and len(val) and all(isinstance(v, np.ndarray) for v in val): state[key] = [shared.share(v) for v in val]
+        state['_mc_data_src'] = state['data'] #Keeps the precomputed likelihood data valid in the workers
+        return Pool(processes=nprocesses, initializer=_mc_worker_init, initargs=(type(self), state, nthreads))
+
     @staticmethod
     def orientation(incl=np.pi/4, PA=0.0):
         return incl, PA
 
+    def _get_sky_operator(self, x_pro, y_pro):
+        """
+        Returns the (cached) interpolation operator from the projected disc points onto the sky mesh.
+        The cache is keyed on the projected coordinates themselves, i.e. on (incl, PA, z-surface) for a given grid.
+        """
+        import hashlib
+        key = hashlib.sha1(np.ascontiguousarray(x_pro).tobytes() + np.ascontiguousarray(y_pro).tobytes()).hexdigest()
+        if key not in self._sky_operators:
+            if len(self._sky_operators) >= self._sky_operators_max: self._sky_operators.pop(next(iter(self._sky_operators)))
+            self._sky_operators[key] = Tools._get_interp_operator(x_pro, y_pro, self.mesh)
+        return self._sky_operators[key]
+
+    def _project_prop(self, sky_operator, prop):
+        operator, outside = sky_operator
+        prop2d = operator.dot(prop)
+        prop2d[outside] = np.nan
+        return prop2d.reshape(self.mesh[0].shape)
+
     def get_projected_coords(self, z_mirror=False, R_inner=0, R_disc=None, 
                              R_nan_val=0, phi_nan_val=10*np.pi, z_nan_val=0):
 
-        from scipy.interpolate import griddata
         #*************************************
         #MAKE TRUE GRID FOR NEAR AND FAR SIDES
         if self.prototype: print ('Getting projected coords for prototype model:', self.params)
@@ -1793,14 +2716,15 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
             xt, yt, zt = grid_true[side][:3]
             x_pro, y_pro, z_pro = self._project_on_skyplane(xt, yt, zt, cos_incl, sin_incl)
             if PA: x_pro, y_pro = self._rotate_sky_plane(x_pro, y_pro, PA)             
-            R[side] = griddata((x_pro, y_pro), self.R_true, (self.mesh[0], self.mesh[1]), method='linear')
-            x_grid = griddata((x_pro, y_pro), xt, (self.mesh[0], self.mesh[1]), method='linear')
-            y_grid = griddata((x_pro, y_pro), yt, (self.mesh[0], self.mesh[1]), method='linear')
+            sky_operator = self._get_sky_operator(x_pro, y_pro)
+            R[side] = self._project_prop(sky_operator, self.R_true)
+            x_grid = self._project_prop(sky_operator, xt)
+            y_grid = self._project_prop(sky_operator, yt)
             phi[side] = np.arctan2(y_grid, x_grid) 
             #Since this one is periodic it has to be recalculated, otherwise the interpolation will screw up things at the boundary -np.pi->np.pi
             # When plotting contours there seems to be in any case some sort of interpolation, so there is still problems at the boundary
             #phi[side] = griddata((x_pro, y_pro), self.phi_true, (self.mesh[0], self.mesh[1]), method='linear')
-            z[side] = griddata((x_pro, y_pro), z_true[side], (self.mesh[0], self.mesh[1]), method='linear')
+            z[side] = self._project_prop(sky_operator, z_true[side])
             #r[side] = hypot_func(R[side], z[side])
             if R_disc is not None: 
                 for prop in [R, phi, z]: prop[side] = np.where(np.logical_and(R[side]<R_disc, R[side]>R_inner), prop[side], np.nan)
@@ -1812,11 +2736,125 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
 
         return R, phi, z, R_nonan, phi_nonan, z_nonan
         
+    cache_stages = True #Reuse the intermediate products of make_model whose parameters did not change
+
+    @staticmethod
+    def _stage_key(*parts):
+        """
+        Hashable key from functions, parameter dicts and scalars. Array values are keyed by their content, 
+        since the repr of large arrays is truncated.
+        """
+        key = []
+        for part in parts:
+            if isinstance(part, dict): key.append(tuple(sorted((k, General2d._stage_key_val(v)) for k, v in part.items())))
+            elif callable(part): key.append(id(part))
+            else: key.append(General2d._stage_key_val(part))
+        return tuple(key)
+
+    @staticmethod
+    def _stage_key_val(val):
+        import hashlib
+        if isinstance(val, np.ndarray): return (val.shape, val.dtype.str, hashlib.sha1(np.ascontiguousarray(val).tobytes()).hexdigest())
+        if isinstance(val, (list, tuple)): return (type(val).__name__,) + tuple(General2d._stage_key_val(v) for v in val)
+        return repr(val)
+
+    @staticmethod
+    def _freeze(val):
+        #Cached products are shared by later calls: their arrays are made read-only so they cannot be modified in place.
+        #make_model returns copies of them
+        if isinstance(val, np.ndarray): val.setflags(write=False)
+        elif isinstance(val, dict): 
+            for v in val.values(): General2d._freeze(v)
+        elif isinstance(val, (list, tuple)):
+            for v in val: General2d._freeze(v)
+        return val
+
+    def _get_stage(self, stage, key, func):
+        """
+        Returns the cached product of ``stage`` if it was computed with the same ``key`` on the same disc and sky grids, 
+        otherwise computes it with func() and caches it. Only the last product of each stage is kept. 
+        The arrays of the products are read-only, hence private to make_model.
+        """
+        cache = self.__dict__.setdefault('_stages', {})
+        key = key + (id(self.R_true), np.shape(self.R_true), id(self.mesh), np.shape(self.mesh[0]))
+        if stage in cache and cache[stage][0] == key: return cache[stage][1]
+        val = self._freeze(func())
+        cache[stage] = (key, val)
+        return val
+
+    def _make_model_cached(self, z_mirror=False, R_inner=0, R_disc=None):
+        """
+        make_model with dependency-tracked caching. Stages and the parameters they depend on:\n
+        height surface: height functions and parameters, z_mirror.\n
+        projection (sky operator and projected R): height surface, incl, PA.\n
+        property maps on the sky: property function and parameters, height surface and projection.\n
+        The systemic velocity of the default velocity functions is added at the end, so steps that only move
+        vsys or the parameters of a single property function skip the geometry and the rest of the properties.
+        """
+        params = self.params
+        incl, PA = General2d.orientation(**params['orientation'])
+        cos_incl, sin_incl = np.cos(incl), np.sin(incl)
+
+        #HEIGHT SURFACE
+        if z_mirror: key_z = self._stage_key(self.z_upper_func, params['height_upper'], z_mirror)
+        else: key_z = self._stage_key(self.z_upper_func, params['height_upper'], z_mirror, self.z_lower_func, params['height_lower'])
+        def get_height():
+            z_near = self.z_upper_func({'R': self.R_true, 'phi': self.phi_true}, **params['height_upper'])
+            if z_mirror: z_far = -z_near
+            else: z_far = self.z_lower_func({'R': self.R_true, 'phi': self.phi_true}, **params['height_lower']) 
+            return {'near': z_near, 'far': z_far}
+        z_true = self._get_stage('height', key_z, get_height)
+        grid_true = {side: [self.x_true, self.y_true, z_true[side], self.R_true, self.phi_true] for side in ['near', 'far']}
+
+        #PROJECTION
+        key_pro = key_z + self._stage_key(incl, PA)
+        def get_projection():
+            sky = {}
+            for side in ['near', 'far']:
+                x_pro, y_pro, z_pro = self._project_on_skyplane(self.x_true, self.y_true, z_true[side], cos_incl, sin_incl)
+                if PA: x_pro, y_pro = self._rotate_sky_plane(x_pro, y_pro, PA)             
+                sky_operator = self._get_sky_operator(x_pro, y_pro)
+                sky[side] = {'operator': sky_operator, 'R': self._project_prop(sky_operator, self.R_true)}
+            return sky
+        sky = self._get_stage('projection', key_pro, get_projection)
+
+        #PROPERTY MAPS
+        avai = [('velocity', self.velocity_func, params['velocity']), ('intensity', self.intensity_func, params['intensity']), 
+                ('linewidth', self.linewidth_func, params['linewidth']), ('lineslope', self.lineslope_func, params['lineslope'])]
+        props = []
+        for name, func, kwargs in avai:
+            if not isinstance(kwargs, dict): continue
+            kwargs_key, vsys = kwargs, 0
+            if name == 'velocity':
+                vsys = kwargs['vsys']
+                if func in [General2d.keplerian, General2d.keplerian_vertical]: #vsys is not used inside these functions
+                    kwargs_key = {k: v for k, v in kwargs.items() if k != 'vsys'}
+                    kwargs = dict(kwargs_key, vsys=0)
+                else: vsys = 0 #Added on the disc grid instead
+            key_prop = self._stage_key(name, func, kwargs_key) + key_pro
+            def get_prop():
+                prop = self._compute_prop(grid_true, [func], [kwargs])[0]
+                if name == 'velocity':
+                    ang_fac = sin_incl * np.cos(self.phi_true)
+                    for side in ['near', 'far']: prop[side] = prop[side] * ang_fac + (kwargs['vsys'] if 'vsys' in kwargs else 0)
+                for side in ['near', 'far']:
+                    if not isinstance(prop[side], numbers.Number): prop[side] = self._project_prop(sky[side]['operator'], prop[side])
+                return prop
+            prop = self._get_stage(name, key_prop, get_prop)
+            prop = {side: prop[side] + vsys if vsys else prop[side] for side in ['near', 'far']}
+            if R_disc is not None: 
+                for side in ['near', 'far']: prop[side] = np.where(np.logical_and(sky[side]['R']<R_disc, sky[side]['R']>R_inner), prop[side], np.nan)
+            elif not vsys: #The caller gets writable copies of the cached maps
+                prop = {side: np.array(prop[side]) if isinstance(prop[side], np.ndarray) else prop[side] for side in ['near', 'far']}
+            props.append(prop)
+        return props
+
     def make_model(self, z_mirror=False, R_inner=0, R_disc=None):
                    
         #*************************************
         #MAKE TRUE GRID FOR NEAR AND FAR SIDES
         if self.prototype: print ('Prototype model:', self.params)
+        if self.cache_stages and not self.subpixels: return self._make_model_cached(z_mirror=z_mirror, R_inner=R_inner, R_disc=R_disc)
         
         incl, PA = General2d.orientation(**self.params['orientation'])
         int_kwargs = self.params['intensity']
@@ -1880,20 +2918,21 @@ class General2d(Height, Velocity, Intensity, Linewidth, Lineslope, Tools, Mcmc):
             xt, yt, zt = grid_true[side][:3]
             x_pro, y_pro, z_pro = self._project_on_skyplane(xt, yt, zt, cos_incl, sin_incl)
             if PA: x_pro, y_pro = self._rotate_sky_plane(x_pro, y_pro, PA)             
-            if R_disc is not None: R_grid = griddata((x_pro, y_pro), self.R_true, (self.mesh[0], self.mesh[1]), method='linear')
+            sky_operator = self._get_sky_operator(x_pro, y_pro) #One triangulation per side, shared by all the properties and subpixels
+            if R_disc is not None: R_grid = self._project_prop(sky_operator, self.R_true)
             x_pro_dict[side] = x_pro
             y_pro_dict[side] = y_pro
             z_pro_dict[side] = z_pro
 
             if self.subpixels:
                 for i in range(self.subpixels_sq): #Subpixels are projected on the same plane where true grid is projected
-                    props[0][i][side] = griddata((x_pro, y_pro), props[0][i][side], (self.mesh[0], self.mesh[1]), method='linear') #subpixels velocity
+                    props[0][i][side] = self._project_prop(sky_operator, props[0][i][side]) #subpixels velocity
                 for prop in props[1:]:
-                    prop[side] = griddata((x_pro, y_pro), prop[side], (self.mesh[0], self.mesh[1]), method='linear')
+                    prop[side] = self._project_prop(sky_operator, prop[side])
                     if R_disc is not None: prop[side] = np.where(np.logical_and(R_grid<R_disc, R_grid>R_inner), prop[side], np.nan) #Todo: allow for R_in as well
             else:
                 for prop in props:
-                    if not isinstance(prop[side], numbers.Number): prop[side] = griddata((x_pro, y_pro), prop[side], (self.mesh[0], self.mesh[1]), method='linear')
+                    if not isinstance(prop[side], numbers.Number): prop[side] = self._project_prop(sky_operator, prop[side])
                     if R_disc is not None: prop[side] = np.where(np.logical_and(R_grid<R_disc, R_grid>R_inner), prop[side], np.nan)
             
         """
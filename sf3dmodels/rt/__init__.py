@@ -13,7 +13,11 @@ if not _ASTROPY_SETUP_:
     #from .example_mod import *
 
     from .core import Lime, Radmc3d, Radmc3dDefaults, Radmc3dRT, MakeDatatab
+    from .table import BinaryTable
+    from .cache import LimeCache
+    from .lte import LTEPopulations
 
 __all__ = ['MakeDatatab', 
            'Lime',
-           'Radmc3d', 'Radmc3dRT', 'Radmc3dDefaults']
+           'Radmc3d', 'Radmc3dRT', 'Radmc3dDefaults',
+           'BinaryTable', 'LimeCache', 'LTEPopulations']
@@ -0,0 +1,144 @@
+"""
+Content-addressed cache of the grids (and level populations) computed by `LIME`_.
+
+The grid and the populations of a LIME run depend on the model table, the non-image parameters and the callbacks of the
+model file, and the molecular and dust data files, but not on the img[] blocks. `LimeCache` hashes all of these and
+writes a small C header pointing the model file to the cached grid of the hash: if the grid is already there, LIME reads
+it back (par->gridInFile) and goes straight to the ray tracing; otherwise LIME writes it (par->gridOutFiles) under a temporary 
+name, which `LimeCache.commit` renames into the cache once LIME is done. Only complete grids then carry the cached name.
+"""
+from __future__ import print_function
+import os
+import re
+import uuid
+import hashlib
+import inspect
+from .table import _replace
+
+__all__ = ['LimeCache']
+
+class LimeCache(object):
+    """
+    Cache of LIME grids, addressed by the hash of their inputs.
+
+    Parameters
+    ----------
+    model_file : str, optional
+       LIME model file. Defaults to 'rt-lime.c'.
+
+    folder : str, optional
+       Folder of the model table ('datatab.dat' or 'datatab.bin', 'header.dat', 'npoints.dat', 'x.dat', 'y.dat', 'z.dat')
+       and of the data files referenced by the model file. Defaults to './'.
+
+    cache_dir : str, optional
+       Cache directory. Defaults to './lime_cache'.
+
+    extra_files : list, optional
+       Additional files on which the grid depends (e.g. a submodel read by the callbacks).
+
+    Attributes
+    ----------
+    key : str
+       Hash of the inputs.
+
+    grid_file : str
+       Path of the cached grid, with populations: '<cache_dir>/<key>/grid.fits'.
+
+    tmp_file : str
+       Path where LIME writes the grid on a miss: '<cache_dir>/<key>/grid.<unique id>.tmp.fits', private to this instance, 
+       so that concurrent runs on the same key do not write into the same file.
+
+    hit : bool
+       Whether the cached grid already exists. A grid left partly written by a crashed run is never counted as a hit, 
+       since it keeps its temporary name.
+
+    Notes
+    -----
+    Usage in the model file, after writing the header with `write_header` (SF3D_CACHE_GRID is grid_file on a hit and tmp_file on a miss):
+
+    .. code-block:: c
+
+       #include "sf3d_cache.h"
+       ...
+       #if SF3D_CACHE_HIT
+         par->gridInFile               = SF3D_CACHE_GRID;
+       #else
+         par->gridOutFiles[4]          = SF3D_CACHE_GRID;
+       #endif
+
+    The header lines are excluded from the hash, so including it does not change the key. 
+    Once LIME has finished, call `commit` to move the new grid into the cache.
+    """
+    #Parameters which only affect the images or the output files
+    image_pars = ['gridfile', 'outputfile', 'binoutputfile', 'gridInFile', 'gridOutFiles', 'restart',
+                  'nThreads', 'traceRayAlgorithm', 'resetRNG']
+    table_files = ['datatab.dat', 'datatab.bin', 'datatab_layout.dat', 'header.dat', 'npoints.dat', 'x.dat', 'y.dat', 'z.dat']
+
+    def __init__(self, model_file='rt-lime.c', folder='./', cache_dir='./lime_cache', extra_files=[]):
+        if folder[-1] != '/': folder += '/'
+        self.model_file = model_file
+        self.folder = folder
+        self.cache_dir = cache_dir
+        self.extra_files = extra_files
+        self.key = self._get_key()
+        self.grid_file = os.path.join(cache_dir, self.key, 'grid.fits')
+        self.tmp_file = os.path.join(cache_dir, self.key, 'grid.%s.tmp.fits'%uuid.uuid4().hex[:12])
+        self.hit = os.path.isfile(self.grid_file)
+        print ('LIME cache key %s: %s'%(self.key, 'hit' if self.hit else 'miss'))
+
+    def _model_source(self):
+        """
+        Model file without comments, blank lines, img[] statements, image-only parameters and cache lines.
+        One statement per line is assumed, as in the model files of the examples.
+        """
+        with open(self.model_file, 'r') as f: source = f.read()
+        source = re.sub(r'/\*.*?\*/', '', source, flags=re.S)
+        source = re.sub(r'//[^\n]*', '', source)
+        skip = re.compile(r'(img\[|i\s*=\s*\d+\s*;|par->(%s)\b|.*SF3D_CACHE|#\s*include\s+"sf3d_cache|#\s*(else|endif))'%'|'.join(self.image_pars))
+        lines = [' '.join(line.split()) for line in source.split('\n')]
+        return '\n'.join(line for line in lines if line and not skip.match(line))
+
+    def _data_files(self, source):
+        #Data files referenced by the model file (moldatfile, dust, ...)
+        names = re.findall(r'par->(?:moldatfile|dust|girdatfile)\s*(?:\[\d+\])?\s*=\s*"([^"]+)"', source)
+        return [name if os.path.isabs(name) else os.path.join(os.path.dirname(self.model_file) or '.', name) for name in names]
+
+    def _get_key(self):
+        h = hashlib.sha1()
+        source = self._model_source()
+        h.update(source.encode())
+        files = [self.folder+tag for tag in self.table_files] + self._data_files(source) + list(self.extra_files)
+        for file in files:
+            if not os.path.isfile(file): continue
+            h.update(os.path.basename(file).encode())
+            with open(file, 'rb') as f:
+                for chunk in iter(lambda: f.read(2**24), b''): h.update(chunk)
+        return h.hexdigest()[:16]
+
+    def write_header(self, output='sf3d_cache.h'):
+        """
+        Writes the C header with the cache macros: SF3D_CACHE_KEY, SF3D_CACHE_GRID and SF3D_CACHE_HIT.
+        SF3D_CACHE_GRID is the cached grid on a hit, and the temporary file to be written by LIME on a miss.
+        Also creates the cache directory of the key.
+        """
+        folder = os.path.dirname(self.grid_file)
+        try: os.makedirs(folder)
+        except OSError: 
+            if not os.path.isdir(folder): raise
+        print ('Writing LIME cache header into %s'%output)
+        with open(output, 'w') as f:
+            f.write('#define SF3D_CACHE_KEY "%s"\n'%self.key)
+            f.write('#define SF3D_CACHE_GRID "%s"\n'%(self.grid_file if self.hit else self.tmp_file))
+            f.write('#define SF3D_CACHE_HIT %d\n'%self.hit)
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+
+    def commit(self):
+        """
+        Moves the grid written by LIME on a miss into the cache, with an atomic rename. 
+        If a concurrent run committed the same key first, its grid is replaced by an identical one. Does nothing on a hit.
+        """
+        if self.hit: return
+        if not os.path.isfile(self.tmp_file): raise ValueError('LIME did not write the grid %s. Did the model file include the cache header?'%self.tmp_file)
+        _replace(self.tmp_file, self.grid_file)
+        self.hit = True
+        print ('LIME cache key %s: grid stored in %s'%(self.key, self.grid_file))
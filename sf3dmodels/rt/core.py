@@ -1,11 +1,16 @@
 from __future__ import print_function
 import os
+import re
 import inspect
 import itertools
 import numpy as np
 from ..utils.units import cm, amu
 from ..utils.prop import propTags
 from ..tools import formatter
+from ..grid.index import SubmodelIndex
+from ..grid.curves import curve_order
+from .table import BinaryTable
+from ..utils import trace
 
 """
 class Emissivity(object):
@@ -68,6 +73,8 @@ class MakeDatatab(object):
             sfile.write("%d %d %d %d %d"%(len(self.columns), Ns[0], Ns[1], Ns[2], self.GRID.NPoints))
             sfile.close()
     
+            self._write_manifest(folder=folder)
+    
         if lime_header:
             header_file = folder+'header.dat'
             print ('Writing columns header into %s'%header_file)
@@ -75,6 +82,42 @@ class MakeDatatab(object):
             np.savetxt(header_file, colswritten, fmt = '%d')
 
         
+    def _write_manifest(self, folder='./'):
+        """
+        Writes the run manifest of the written model for Lime: 'manifest.dat' (one 'key value' pair per line)
+        and 'sf3d_manifest.h' (the same values as C macros, SF3D_<KEY>), to be included by the model file. 
+
+        - ncells: number of rows written, for par->pIntensity.
+        - ndummies: number of dummy points added with `~sf3dmodels.grid.fillgrid.Random`.
+        - nboundary: number of cells lying within one cell spacing of the domain sphere, which LIME may flag as sink points. 
+        - sinkpoints: the larger of nboundary and ndummies, for par->sinkPoints.
+        - radius: radius of the sphere enclosing all the cells, for par->radius.
+        - minscale: half the smallest cell spacing, for par->minScale.
+        """
+        if folder[-1] != '/': folder += '/'
+        xyz = np.asarray(self.GRID.XYZ, dtype=float)
+        r = np.linalg.norm(xyz, axis=0)
+        steps = [xc[1]-xc[0] for xc in getattr(self.GRID, 'XYZcentres', []) if len(xc) > 1]
+        if len(steps): spacing = np.full(len(r), min(steps)) #Regular grid
+        else: #Irregular grid, or a single cell: distance to the nearest neighbour
+            from scipy.spatial import cKDTree
+            spacing = cKDTree(xyz.T).query(xyz.T, k=2)[0][:,1] if len(r) > 1 else np.zeros(len(r))
+        radius = r.max()
+        ndummies = getattr(self.GRID, 'ndummies', 0)
+        nboundary = np.sum(r + spacing >= radius)
+        manifest = [('ncells', '%d', self.GRID.NPoints),
+                    ('ndummies', '%d', ndummies),
+                    ('nboundary', '%d', nboundary),
+                    ('sinkpoints', '%d', max(nboundary, ndummies)),
+                    ('radius', '%.8e', radius),
+                    ('minscale', '%.8e', 0.5*spacing[spacing > 0].min() if (spacing > 0).any() else 0.0)]
+        manifest_file, c_file = folder+'manifest.dat', folder+'sf3d_manifest.h'
+        print ('Writing run manifest into %s and %s'%(manifest_file, c_file))
+        with open(manifest_file, 'w') as f: 
+            for key, fmt, val in manifest: f.write(('%s '+fmt+'\n')%(key, val))
+        with open(c_file, 'w') as f: 
+            for key, fmt, val in manifest: f.write(('#define SF3D_%s '+fmt+'\n')%(key.upper(), val))
+
     def _prepare_prop(self, prop):
         """
         Prepare the prop object to write its content in ordered columns according to _col_ids().
@@ -116,7 +159,8 @@ class MakeDatatab(object):
         self.prop_header = {prop_keys_sorted[i]: prop_id_sorted[i] for i in range(self.n)}
         self.prop = prop
         
-    def submodel(self, prop, output = '0.dat', fmt = '%.6e', folder = './Subgrids', lime_npoints=False, lime_header=False):        
+    @trace.stage
+    def submodel(self, prop, output = '0.dat', fmt = '%.6e', folder = './Subgrids', lime_npoints=False, lime_header=False, index=False):        
         """
         Writes a preliminary model. 
         This method **must** be used either from the radiative transfer class `~sf3dmodels.rt.Lime` or `~sf3dmodels.rt.Radmc3d`. 
@@ -140,6 +184,11 @@ class MakeDatatab(object):
 
         folder : str, optional
            Sets the folder to write the files in. Defaults to './Subgrids'.
+
+        index : bool, optional
+           If True, writes the sidecar spatial index of the submodel ('<output>.idx'), 
+           used by `~sf3dmodels.grid.Overlap.fromfiles` to skip the regions of the submodel outside the global grid. 
+           See `~sf3dmodels.grid.SubmodelIndex`. Defaults to False.
            
         Attributes
         ----------
@@ -180,13 +229,16 @@ class MakeDatatab(object):
         list2write = iter(np.array([self.id] + self.prop_list).T)
         print ('Writing Submodel data in %s'%file_path)
         for _ in itertools.repeat(None, self.GRID.NPoints): tmp_write.append( fmt_string % tuple(next(list2write)) )
-        file_data = open(file_path, 'w')        
-        file_data.writelines(tmp_write)
+        with open(file_path, 'w') as file_data: file_data.writelines(tmp_write)
+        if index:
+            print ('Writing spatial index in %s'%SubmodelIndex.index_path(file_path))
+            xyz_cols = [self.columns.tolist().index(coord) for coord in ['x','y','z']]
+            SubmodelIndex(file_path, xyz_cols=xyz_cols).build(lines=tmp_write).write()
         
         #self.prop_id = np.insert(self.prop_id, 0, [self.sf3d_header[coord] for coord in ['x','y','z']]) 
 
         self._write_npoints_header(folder=folder, lime_npoints=lime_npoints, lime_header=lime_header)
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------\n-------------------------------------------------')
                 
 
@@ -295,7 +347,31 @@ class Lime(MakeDatatab):
 
         self.sf3d_header = {key.split('_',1)[1]: base[key] for key in base}
         
-    def finalmodel(self, prop, fmt = '%.6e', folder = './'):
+    def model_columns(self, model_file):
+        """
+        Finds the table fields used by a LIME model file, i.e. the ``sf3d->field`` references outside comments.
+
+        Parameters
+        ----------
+        model_file : str
+           LIME model file, e.g. 'rt-lime.c'.
+
+        Returns
+        -------
+        columns : dict
+           Used fields and their column id. The id (0) and coordinates (1-3) are always included.
+        """
+        with open(model_file, 'r') as f: source = f.read()
+        source = re.sub(r'/\*.*?\*/', '', source, flags=re.S)
+        source = re.sub(r'//[^\n]*', '', source)
+        fields = set(re.findall(r'sf3d->(\w+)', source))
+        unknown = fields.difference(self.sf3d_header)
+        if len(unknown) > 0: raise KeyError('The fields %s used in %s are not available for Lime tables'%(sorted(unknown), model_file))
+        fields.update(['id', 'x', 'y', 'z'])
+        return {key: self.sf3d_header[key] for key in sorted(fields, key=lambda key: self.sf3d_header[key])}
+
+    @trace.stage
+    def finalmodel(self, prop, fmt = '%.6e', folder = './', order = None, descending_radius = False, nshells = 64, storage = None, model_file = None):
         """
         Writes the final model into file. The output is ready to be read with `LIME`_ 
         
@@ -312,12 +388,46 @@ class Lime(MakeDatatab):
 
         folder : str, optional
            Sets the folder to write the files in. Defaults to './'.
+
+        order : 'morton', 'hilbert' or None, optional
+           If set, the cells are renumbered along the chosen space-filling curve, so that cells close in space are also close
+           in the sf3d arrays read by the LIME callbacks. The rows are then written with their new id and the x, y, z columns 
+           (as in `~sf3dmodels.rt.MakeDatatab.submodel`), and the original id of each row is stored in 'permutation.dat'.
+           See `~sf3dmodels.grid.curves.curve_order`. Defaults to None, i.e. ``meshgrid`` order.
+
+        descending_radius : bool, optional
+           If True, the cells are written from the outermost to the innermost of ``nshells`` radial shells 
+           (by strictly descending radius if ``order`` is None), which prevents LIME's reorderGrid from flagging 
+           the last grid points as sink points. See `~sf3dmodels.Model.DataTab_LIME2`. With ``order`` set, 
+           the outermost shell, which holds the cells close to the domain radius, is still sorted by strictly descending radius, 
+           and the order follows the curve within the inner shells only. Defaults to False.
+
+        nshells : int, optional
+           Number of radial shells for ``descending_radius``. Defaults to 64.
+
+        storage : 'float32', 'float64' or None, optional
+           If set, the table is also written in binary form ('datatab.bin' and 'datatab_layout.dat', see `~sf3dmodels.rt.BinaryTable`),
+           with the physical properties stored in the chosen precision. The cell ids and coordinates are always stored 
+           with 64 bits. This is only the writer side: the model files of LIME still read 'datatab.dat', and the binary 
+           format is meant for a loader to come. Note that 'float32' flushes to zero any value below ~1e-38, 
+           e.g. small abundances, and keeps about 7 significant digits. 
+           Use `~sf3dmodels.tools.compare_images` to check the effect on the images.
+           Tables written before can be converted with `~sf3dmodels.rt.BinaryTable.from_datatab`.
+           Defaults to None.
+
+        model_file : str, optional
+           If set, only the properties used by this LIME model file are written (see `model_columns`),
+           e.g. temp_gas is dropped if the temperature callback sets constant values.
+           All the abundances are kept if any of them is used, since they are indexed by position. Defaults to None.
            
         Attributes
         ----------
         prop_header : dict
            Dictionary relating the input prop keys to their characteristic id according to the Lime requirements.
 
+        permutation : `numpy.ndarray`
+           Original id of each written row. Only if ``order`` or ``descending_radius`` are set.
+
         prop_keys : array_like
            Array object containing the column names of the physical properties written into file.
 
@@ -353,19 +463,38 @@ class Lime(MakeDatatab):
            Data file made from the ``prop``'s content. The columns are sorted according to the id's table in the **Notes** section of the `Lime` class. 
         'npoints.dat' : file
            File containing the number of columns in 'datatab.dat', the number of cells along x,y,z, and the total number of cells.
+        'manifest.dat', 'sf3d_manifest.h' : file
+           Run manifest: number of cells, dummies and boundary cells, and suggested radius and minScale for the model file.
         'header.dat' : file
            File specifying the column ids according to the table in the **Notes** section of the `Lime` class.
         'x.dat' : file
         'y.dat' : file
         'z.dat' : file     
+        'permutation.dat' : file
+           Original id of each row in 'datatab.dat'. Only if ``order`` or ``descending_radius`` are set.
+        'datatab.bin', 'datatab_layout.dat' : file
+           Binary table and its columns layout. Only if ``storage`` is set.
         """
 
+        if folder[-1] != '/': folder += '/'
+        if order is not None or descending_radius:
+            self.permutation = curve_order(self.GRID.XYZ, curve=order, descending_radius=descending_radius, nshells=nshells)
+            x,y,z = self.GRID.XYZ
+            prop = dict(prop, x=x, y=y, z=z)
+            prop = {key: np.asarray(prop[key])[self.permutation] for key in prop}
+            print ('Writing cells permutation into %s'%(folder+'permutation.dat'))
+            np.savetxt(folder+'permutation.dat', self.permutation, fmt = '%d')
+
+        if model_file is not None:
+            used = self.model_columns(model_file)
+            dropped = [key for key in prop if ('abundance' if 'abundance' in key else key) not in used]
+            if len(dropped) > 0: print ('Skipping properties not used by %s:'%model_file, dropped)
+            prop = {key: prop[key] for key in prop if key not in dropped}
+
         self._prepare_prop(prop)
         self.id = np.arange(self.GRID.NPoints)
         self.columns = np.append(['id'], self.prop_keys)
 
-        if folder[-1] != '/': folder += '/'
-
         fmt_string = formatter(self.prop_keys, fmt, base = '%d')
         tmp_write = []
         #if type(self.prop_list) == np.ndarray: self.prop_list = self.prop_list.tolist()
@@ -376,6 +505,11 @@ class Lime(MakeDatatab):
         for _ in itertools.repeat(None, self.GRID.NPoints): tmp_write.append( fmt_string % tuple(next(list2write)) )
         file_data = open(files[0],'w')
         file_data.writelines(tmp_write)
+        file_data.close()
+
+        if storage is not None:
+            print ('Writing %s binary table into %s'%(storage, folder+'datatab.bin'))
+            BinaryTable.write(folder+'datatab.bin', np.append(0, self.prop_id), [self.id] + self.prop_list, storage=storage)
 
         Ns = self.GRID.Nodes
         size_file = folder+'npoints.dat'
@@ -383,6 +517,7 @@ class Lime(MakeDatatab):
         print ('Writing grid size into %s'%size_file)
         sfile.write("%d %d %d %d %d"%(len(self.columns), Ns[0], Ns[1], Ns[2], self.GRID.NPoints))
         sfile.close()
+        self._write_manifest(folder=folder)
 
         header_file = folder+'header.dat'
         print ('Writing columns header into %s'%header_file)
@@ -394,7 +529,7 @@ class Lime(MakeDatatab):
             print ('%s'%files[i])
             np.savetxt(files[i], self.GRID.XYZcentres[i-1], fmt = '%.8e')
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------\n-------------------------------------------------')
 
 
@@ -481,6 +616,7 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
 
         self.sf3d_header = base
         
+    @trace.stage
     def write_amr_grid(self, iformat = 1, 
                        grid_style = 0, 
                        coord_system = 0,
@@ -522,9 +658,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             f.write((tmp[2]+'\n')%tuple(zi)) # Z values (cell walls)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
         
+    @trace.stage
     def write_electron_numdens(self, dens_e, fmt = '%13.6e'):
         """
         Writes the file 'electron_numdens.inp' for radmc3d. 
@@ -545,9 +682,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             dens_e.tofile(f, sep='\n', format=fmt)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_ion_numdens(self, dens_ion, fmt = '%13.6e'):
         """
         Writes the file 'ion_numdens.inp' for radmc3d. 
@@ -568,9 +706,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             dens_ion.tofile(f, sep='\n', format=fmt)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_dust_density(self, dens_dust, nrspec = 1, fmt = '%13.6e'):
         """
         Writes the file 'dust_density.inp' for radmc3d. 
@@ -592,9 +731,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             dens_dust.tofile(f, sep='\n', format=fmt)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_gas_temperature(self, temp_gas, fmt = '%13.6e'):
         """
         Writes the file 'gas_temperature.inp' for radmc3d. 
@@ -614,9 +754,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             temp_gas.tofile(f, sep='\n', format=fmt)
             f.close()
             
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_dust_temperature(self, temp_dust, fmt = '%13.6e'):
         """
         Writes the file 'dust_temperature.inp' for radmc3d. 
@@ -636,10 +777,11 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             temp_dust.tofile(f, sep='\n', format=fmt)
             f.close()
             
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
 
+    @trace.stage
     def write_microturbulence(self, microturbulence, fmt = '%13.6e'):
         """
         Writes the file 'microturbulence.inp' for radmc3d. 
@@ -661,9 +803,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             microturb.tofile(f, sep='\n', format=fmt)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_gas_velocity(self, vel, fmt = '%13.6e'):
         """
         Writes the file 'gas_velocity.inp' for radmc3d.
@@ -689,9 +832,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             #vel2wrt.tofile(f, sep='\n', format=fmt)
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_radmc3d_control(self, **kwargs):
         """
         Writes the control file 'radmc3d.inp'.
@@ -713,7 +857,7 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
             for key in kwargs: f.write('{} = {}\n'.format(key, kwargs[key]))
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
     def _write_lam(self, file, lam, nxx):
@@ -732,6 +876,7 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
 
         else: raise ValueError("Wrong length(s) for input list(s): len(lam)-1 must be equal to len(nxx)")
         
+    @trace.stage
     def write_wavelength_micron(self, lam = [1e-1,5e2,2e4,4e4,3e5], nxx = [50,50,50,50], fmt = '%13.6e'):
         """
         Writes the file 'wavelength_micron.inp' for radmc3d.
@@ -772,9 +917,10 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
 
         else: sys.exit("ERROR: Wrong length(s) for input list(s): len(lam)-1 must be equal to len(nxx)")
         """
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
 
+    @trace.stage
     def write_stars(self, nstars = 1, pos = [[0.,0.,0.]], 
                     rstars = [6.96e8], mstars = [1.99e30],
                     lam = [1e-1,5e2,2e4,4e4,3e5], nxx = [50,50,50,50], 
@@ -833,7 +979,7 @@ class Radmc3d(MakeDatatab): #RADMC-3D uses the cgs units system
 
             f.close()
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------')
         
 
@@ -866,6 +1012,7 @@ class Radmc3dDefaults(Radmc3d):
         if rstr: return {'mand': mandstr, 'opt': optstr} 
         else: return {'mand': mand, 'opt': opt} 
 
+    @trace.stage
     def freefree(self, prop, fmt = '%13.6e', folder = './', 
                  kwargs_control = {'scattering_mode_max': 0,
                                    'incl_dust': 0,
@@ -927,7 +1074,7 @@ class Radmc3dDefaults(Radmc3d):
         """ 
         _keys = list(self._freefree_keys())
         
-        func_name = inspect.stack()[0][3]
+        func_name = inspect.currentframe().f_code.co_name
         print ('Setting %s mode for RADMC-3D...'%func_name)
         
         self.write_amr_grid()
@@ -941,7 +1088,7 @@ class Radmc3dDefaults(Radmc3d):
         self.write_radmc3d_control(**kwargs_control)
         self.write_wavelength_micron(**kwargs_wavelength)
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------\n-------------------------------------------------')
 
     def _recomblines_keys(rstr = False):
@@ -1020,7 +1167,7 @@ class Radmc3dDefaults(Radmc3d):
         """ 
         _keys = list(self._recomblines_keys())
 
-        func_name = inspect.stack()[0][3]
+        func_name = inspect.currentframe().f_code.co_name
         print ('Setting %s mode for RADMC-3D...'%func_name)
 
         self.write_amr_grid()
@@ -1048,7 +1195,7 @@ class Radmc3dDefaults(Radmc3d):
         self.write_radmc3d_control(**kwargs_tmp)
         self.write_wavelength_micron(**kwargs_wavelength)
 
-        print ('%s is done!'%inspect.stack()[0][3])
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
         print ('-------------------------------------------------\n-------------------------------------------------')
 
 Radmc3dRT = Radmc3dDefaults #Backwards compatibility
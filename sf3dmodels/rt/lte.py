@@ -0,0 +1,137 @@
+"""
+Level populations in Local Thermodynamic Equilibrium (LTE), for the lte_only models of `LIME`_.
+
+In LTE the fractional population of each level only depends on the local gas temperature and on the partition function
+of the molecule, n_i/n = g_i exp(-E_i/kT) / Z(T). `LTEPopulations` evaluates them for all the levels and all the cells
+of a model table at once, in vectorized chunks spread over threads, without any per-cell solver or callback.
+
+This is a standalone reference implementation, e.g. to inspect or plot the LTE populations of a model, and not a fast 
+path for LIME: nothing in LIME reads its output, and the lte_only mode of LIME already computes the same populations in C.
+"""
+from __future__ import print_function
+import inspect
+import multiprocessing
+import numpy as np
+from ..utils.constants import h, c, kb
+
+__all__ = ['LTEPopulations']
+
+class LTEPopulations(object):
+    """
+    LTE level populations of a molecule. Standalone reference, see the module notes: LIME does not use them.
+
+    Parameters
+    ----------
+    moldatfile : str
+       Molecular data file in the `LAMDA <https://home.strw.leidenuniv.nl/~moldata/>`_ format, as the ``par->moldatfile`` of LIME.
+
+    nthreads : int, optional
+       Number of threads. Defaults to None, i.e. the number of available cpus.
+
+    chunk_size : int, optional
+       Number of cells evaluated at once by each thread. Defaults to 2**16.
+
+    Attributes
+    ----------
+    name : str
+       Name of the molecule.
+
+    energies : `numpy.ndarray`
+       Level energies, in J.
+
+    weights : `numpy.ndarray`
+       Statistical weights of the levels.
+    """
+    def __init__(self, moldatfile, nthreads=None, chunk_size=2**16):
+        self.moldatfile = moldatfile
+        self.nthreads = nthreads if nthreads is not None else multiprocessing.cpu_count()
+        self.chunk_size = int(chunk_size)
+        self._read_lamda(moldatfile)
+        self._e_kb = (self.energies - self.energies.min()) / kb #Level energies in K, relative to the ground level
+
+    def _read_lamda(self, file):
+        with open(file, 'r') as f: lines = [line.strip() for line in f if line.strip()]
+        self.name = lines[1]
+        nlev = int(lines[5].split()[0]) #Line 6: number of energy levels, after the name, weight and their comment lines
+        levels = np.array([line.split()[1:3] for line in lines[7:7+nlev]], dtype=float)
+        self.energies = levels[:,0] * 100 * h * c #cm^-1 to J
+        self.weights = levels[:,1]
+        self.nlevels = nlev
+
+    def partition(self, temp):
+        """
+        Partition function Z(T), summed over the levels of the data file.
+        """
+        temp = np.asarray(temp, dtype=float)
+        with np.errstate(divide='ignore', over='ignore'):
+            return (self.weights * np.exp(-self._e_kb / temp[...,None])).sum(axis=-1)
+
+    def _chunk(self, temp, out):
+        with np.errstate(divide='ignore', invalid='ignore', over='ignore'):
+            pops = self.weights * np.exp(-self._e_kb * (1.0 / temp)[:,None])
+            pops /= pops.sum(axis=1)[:,None]
+        cold = ~(temp > 0) #Null (or missing) temperatures: everything in the ground level
+        if cold.any(): pops[cold] = np.eye(1, self.nlevels)
+        out[:] = pops
+
+    def __call__(self, temp, out=None, dtype=np.float32):
+        """
+        Computes the fractional populations of all the levels.
+
+        Parameters
+        ----------
+        temp : array_like, shape (ncells,)
+           Gas temperature of each cell, in K.
+
+        out : array_like, shape (ncells, nlevels), optional
+           Output array, e.g. a `numpy.memmap`. Defaults to None, i.e. a new array.
+
+        dtype : data-type, optional
+           Data type of the new output array. Defaults to np.float32.
+
+        Returns
+        -------
+        pops : `numpy.ndarray`, shape (ncells, nlevels)
+           Fractional level populations. Each row adds up to one.
+        """
+        temp = np.asarray(temp)
+        ncells = len(temp)
+        if out is None: out = np.empty((ncells, self.nlevels), dtype=dtype)
+        bounds = range(0, ncells, self.chunk_size)
+        work = lambda i: self._chunk(temp[i:i+self.chunk_size].astype(np.float64), out[i:i+self.chunk_size])
+        if self.nthreads == 1 or len(bounds) == 1:
+            for i in bounds: work(i)
+        else:
+            from concurrent.futures import ThreadPoolExecutor
+            with ThreadPoolExecutor(max_workers=self.nthreads) as executor: list(executor.map(work, bounds))
+        return out
+
+    def from_table(self, table, output=None):
+        """
+        Computes the populations of all the cells of a model table, straight from its gas temperature column (id 11).
+
+        Parameters
+        ----------
+        table : str or `~sf3dmodels.rt.BinaryTable`
+           Binary table, or the folder of an ASCII table written by `~sf3dmodels.rt.Lime.finalmodel`
+           (converted first with `~sf3dmodels.rt.BinaryTable.from_datatab`).
+
+        output : str, optional
+           If set, the populations are written into this .npy file, through a memory map. Defaults to None.
+
+        Returns
+        -------
+        pops : `numpy.ndarray`, shape (ncells, nlevels)
+        """
+        from .table import BinaryTable
+        if isinstance(table, str): table = BinaryTable.from_datatab(table)
+        if 11 not in table.col_ids: raise ValueError('The table %s has no gas temperature column (id 11)'%table.file)
+        temp = table.column(table.col_ids.index(11))
+        out = None
+        if output is not None:
+            print ('Writing %s LTE populations into %s'%(self.name, output))
+            out = np.lib.format.open_memmap(output, mode='w+', dtype=np.float32, shape=(table.nrows, self.nlevels))
+        pops = self(temp, out=out)
+        if output is not None: pops.flush()
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+        return pops
@@ -0,0 +1,208 @@
+"""
+Binary storage of the property tables read by the radiative transfer codes.
+
+The table is stored column after column in a raw little-endian file (e.g. 'datatab.bin'), next to a plain-text layout file
+(e.g. 'datatab_layout.dat') which any reader, including the C model files of LIME, can parse with fscanf.
+The layout starts with a line 'nrows ncols', followed by one line per column: 'col_id dtype offset', where col_id is the
+column id of the radiative transfer class (as in 'header.dat'), dtype is one of 'i8', 'f8', 'f4' and offset is the
+position of the column in the data file, in bytes. Columns start at multiples of 8 bytes.
+
+The binary file is meant to be memory-mapped read-only (mmap with PROT_READ, MAP_SHARED) by every process using the model:
+the operating system then keeps a single copy of the table in the page cache, shared by all the concurrent jobs on a node,
+and the table is not parsed again at the startup of each job.
+"""
+from __future__ import print_function
+import os
+import inspect
+import numpy as np
+
+__all__ = ['BinaryTable']
+
+def _replace(src, dst):
+    #Atomic rename over an existing file. os.replace is Python >= 3.3; os.rename already overwrites on POSIX
+    if hasattr(os, 'replace'): os.replace(src, dst)
+    else:
+        if os.name == 'nt' and os.path.exists(dst): os.remove(dst)
+        os.rename(src, dst)
+
+class BinaryTable(object):
+    """
+    Column-wise binary property table.
+
+    Parameters
+    ----------
+    file : str
+       Path to the binary data file. The layout is read from (or written into) '<file without extension>_layout.dat'.
+
+    Attributes
+    ----------
+    nrows : int
+       Number of rows (cells).
+
+    col_ids, dtypes, offsets : list
+       Column id, data type and byte offset of each column, in file order.
+    """
+    coord_ids = [0, 1, 2, 3] #id, x, y, z: always stored with 64 bits
+
+    def __init__(self, file):
+        self.file = file
+        self.nrows = 0
+        self.col_ids, self.dtypes, self.offsets = [], [], []
+
+    @staticmethod
+    def layout_path(file):
+        return os.path.splitext(file)[0] + '_layout.dat'
+
+    def _write_layout(self, file):
+        with open(file, 'w') as f:
+            f.write('%d %d\n'%(self.nrows, len(self.col_ids)))
+            for col_id, dtype, off in zip(self.col_ids, self.dtypes, self.offsets): f.write('%d %s %d\n'%(col_id, dtype, off))
+
+    @classmethod
+    def _dtype(cls, col_id, storage):
+        if storage not in ['float32', 'float64']: raise ValueError("The value '%s' in storage is invalid. Please choose amongst the following: 'float32', 'float64'"%storage)
+        if col_id == 0: return np.dtype('<i8')
+        elif col_id in cls.coord_ids: return np.dtype('<f8')
+        else: return np.dtype('<f4') if storage == 'float32' else np.dtype('<f8')
+
+    @classmethod
+    def write(cls, file, col_ids, columns, storage='float32'):
+        """
+        Writes the columns into ``file`` and its layout file.
+
+        Parameters
+        ----------
+        col_ids : array_like, shape (ncols,)
+           Column id of each column. Columns 0 (cell id) and 1-3 (x,y,z) are stored as int64 and float64 respectively.
+
+        columns : list of array_like
+           Column values, all of the same length.
+
+        storage : 'float32' or 'float64', optional
+           Precision of the remaining (property) columns. With 'float32', values below ~1e-38 (e.g. small abundances)
+           are flushed to zero. Defaults to 'float32'.
+        """
+        table = cls(file)
+        table.nrows = len(columns[0])
+        offset = 0
+        with open(file, 'wb') as f:
+            for col_id, col in zip(col_ids, columns):
+                dtype = cls._dtype(col_id, storage)
+                data = np.asarray(col).astype(dtype)
+                f.write(data.tobytes())
+                pad = -data.nbytes % 8
+                f.write(b'\0'*pad)
+                table.col_ids.append(int(col_id))
+                table.dtypes.append(dtype.str[1:])
+                table.offsets.append(offset)
+                offset += data.nbytes + pad
+        table._write_layout(cls.layout_path(file))
+        return table
+
+    @classmethod
+    def from_datatab(cls, folder='./', output='datatab.bin', storage='float64', chunk_size=2**20, overwrite=False, columns=None):
+        """
+        Converts an existing ASCII table, written by `~sf3dmodels.rt.Lime.finalmodel`, into a binary table.
+
+        The conversion runs once per model: if the binary table is newer than 'datatab.dat', and has the requested columns,
+        storage and number of rows (as in 'npoints.dat'), it is kept as it is,
+        so that the concurrent jobs reading the same folder only attach to it. The files are written under temporary names
+        and renamed at the end, hence a job never reads a partially written table.
+
+        Parameters
+        ----------
+        folder : str, optional
+           Folder containing 'datatab.dat', 'header.dat' and 'npoints.dat'. Defaults to './'.
+
+        output : str, optional
+           Name of the binary table, written in ``folder``. Defaults to 'datatab.bin'.
+
+        storage : 'float32' or 'float64', optional
+           Precision of the property columns, see `write`. Defaults to 'float64'.
+
+        chunk_size : int, optional
+           Number of rows parsed at once. Defaults to 2**20.
+
+        overwrite : bool, optional
+           If True, the binary table is written even if it is up to date. Defaults to False.
+
+        columns : array_like, optional
+           Column ids to keep, e.g. the values of `~sf3dmodels.rt.Lime.model_columns` for the model file to be run.
+           The id column is always kept. Defaults to None, i.e. all the columns.
+
+        Returns
+        -------
+        table : `BinaryTable`
+        """
+        if folder[-1] != '/': folder += '/'
+        file, ascii_file = folder+output, folder+'datatab.dat'
+        header = np.loadtxt(folder+'header.dat', dtype=int)
+        col_ids = header[:-1] #The last one is the end-of-file id 4242
+        usecols = np.arange(len(col_ids))
+        if columns is not None: 
+            usecols = usecols[np.isin(col_ids, np.append(0, columns))]
+            col_ids = col_ids[usecols]
+
+        nrows = int(np.loadtxt(folder+'npoints.dat', dtype=int)[-1])
+        dtypes = [cls._dtype(col_id, storage).str[1:] for col_id in col_ids]
+
+        if (not overwrite and os.path.isfile(file) and os.path.isfile(cls.layout_path(file)) 
+            and os.path.getmtime(file) >= os.path.getmtime(ascii_file)): 
+            table = cls.load(file)
+            if table.col_ids == col_ids.tolist() and table.dtypes == dtypes and table.nrows == nrows:
+                print ('Using existing binary table %s'%file)
+                return table
+        tmp_file = file + '.%d.tmp'%os.getpid()
+        
+        print ('Writing %s binary table from %s into %s'%(storage, ascii_file, file))
+        itemsize = [np.dtype(dtype).itemsize for dtype in dtypes]
+        offsets = np.cumsum([0] + [nrows*size + (-nrows*size % 8) for size in itemsize])
+        with open(tmp_file, 'wb') as f: f.truncate(offsets[-1])
+        data = [np.memmap(tmp_file, dtype='<'+dtype, mode='r+', offset=off, shape=(nrows,)) for dtype, off in zip(dtypes, offsets)]
+        row = 0
+        with open(ascii_file, 'r') as f:
+            while row < nrows:
+                lines = [line for _, line in zip(range(chunk_size), f)]
+                if len(lines) == 0: raise ValueError('%s has fewer rows (%d) than expected (%d)'%(ascii_file, row, nrows))
+                chunk = np.loadtxt(lines, usecols=usecols, ndmin=2)
+                for i in range(len(col_ids)): data[i][row:row+len(chunk)] = chunk[:,i]
+                row += len(chunk)
+        for col in data: col.flush()
+        del data
+
+        table = cls(file)
+        table.nrows, table.col_ids, table.dtypes, table.offsets = nrows, col_ids.tolist(), dtypes, offsets[:-1].tolist()
+        table._write_layout(cls.layout_path(tmp_file))
+        _replace(tmp_file, file)
+        _replace(cls.layout_path(tmp_file), cls.layout_path(file))
+        print ('%s is done!'%inspect.currentframe().f_code.co_name)
+        return table
+
+    @classmethod
+    def load(cls, file):
+        """
+        Reads the layout of ``file``.
+        """
+        table = cls(file)
+        with open(cls.layout_path(file), 'r') as f:
+            table.nrows, ncols = [int(val) for val in f.readline().split()]
+            for _ in range(ncols):
+                col_id, dtype, offset = f.readline().split()
+                table.col_ids.append(int(col_id))
+                table.dtypes.append(dtype)
+                table.offsets.append(int(offset))
+        return table
+
+    def column(self, i, widen=False):
+        """
+        Memory-mapped (read-only) values of the i-th column of the file. If ``widen``, float32 columns are returned as float64 copies.
+        """
+        data = np.memmap(self.file, dtype='<'+self.dtypes[i], mode='r', offset=self.offsets[i], shape=(self.nrows,))
+        if widen and self.dtypes[i] == 'f4': return data.astype(np.float64)
+        return data
+
+    def columns(self, widen=False):
+        """
+        Returns the list of all the columns, see `column`.
+        """
+        return [self.column(i, widen=widen) for i in range(len(self.col_ids))]
@@ -13,6 +13,6 @@ if not _ASTROPY_SETUP_:
     #from .example_mod import *
 
     from . import transform
-    from .core import formatter
+    from .core import formatter, compare_images
 
-__all__ = ['transform', 'formatter']
+__all__ = ['transform', 'formatter', 'compare_images']
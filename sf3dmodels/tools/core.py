@@ -1,6 +1,7 @@
+from __future__ import print_function
 import numpy as np
 
-__all__ = ['formatter']
+__all__ = ['formatter', 'compare_images']
 
 def formatter(prop_keys, fmt = '%.6e', base = '', default = '%.6e'):
     """
@@ -44,3 +45,45 @@ def formatter(prop_keys, fmt = '%.6e', base = '', default = '%.6e'):
     else: raise TypeError("Invalid type %s for 'fmt'. Please provide a valid 'fmt' object: str, list or np.ndarray"%type(fmt))
     fmt_string += '\n'
     return fmt_string
+
+def compare_images(reference, test, threshold = 1e-3):
+    """
+    Reports the changes between pairs of images (e.g. FITS images from `LIME`_ computed from the float64 and float32
+    storage modes of `~sf3dmodels.rt.Lime.finalmodel`).
+    
+    Parameters
+    ----------
+    reference, test : str, array_like or list
+       Reference and test images: FITS file paths or arrays. Lists of them are compared pair by pair.
+    
+    threshold : float, optional
+       Pointwise relative changes are only computed on pixels brighter than this fraction of the peak of the reference image. Defaults to 1e-3.
+    
+    Returns
+    -------
+    report : list of dict
+       For each pair: 'max_abs' maximum absolute change, 'max_rel' maximum absolute change relative to the peak of the reference,
+       and 'max_rel_pixel' maximum pointwise relative change on the pixels above ``threshold``.
+    """
+    if isinstance(reference, (str, np.ndarray)): reference, test = [reference], [test]
+    if len(reference) != len(test): raise ValueError('The number of reference and test images must be the same')
+
+    def read(image):
+        if isinstance(image, str):
+            from astropy.io import fits
+            return np.squeeze(fits.getdata(image)).astype(np.float64)
+        return np.asarray(image, dtype=np.float64)
+
+    report = []
+    for i, (ref, tst) in enumerate(zip(reference, test)):
+        a, b = read(ref), read(tst)
+        if a.shape != b.shape: raise ValueError('Images #%d have different shapes: %s, %s'%(i, a.shape, b.shape))
+        diff = np.abs(b - a)
+        peak = np.nanmax(np.abs(a))
+        bright = np.abs(a) > threshold*peak
+        tmp = {'max_abs': np.nanmax(diff),
+               'max_rel': np.nanmax(diff) / peak if peak > 0 else np.nan,
+               'max_rel_pixel': np.nanmax(diff[bright] / np.abs(a[bright])) if bright.any() else np.nan}
+        print ('Image #%d: max abs change %.3e, max change relative to peak %.3e, max pointwise relative change %.3e'%(i, tmp['max_abs'], tmp['max_rel'], tmp['max_rel_pixel']))
+        report.append(tmp)
+    return report
@@ -12,6 +12,8 @@ kb = 1.38064852e-23 #(J K^-1) Boltzmann constant
 sigma = 5.670373e-8 #(W m^-2 K^-4) Stefan-Boltzmann constant
 
 temp_cmb = 2.72548 #(K) CMB black-body temperature
+
+h = 6.62607015e-34 #(J s) Planck constant
 """
 from .units import amu
 #***************
@@ -24,3 +26,4 @@ kb = 1.38064852e-23 #(J K^-1) Boltzmann constant
 sigma = 5.670373e-8 #(W m^-2 K^-4)Stefan-Boltzmann constant
 temp_cmb = 2.72548 #(K) CMB black-body temperature
 c = 299792458. #(m/s) Speed of light
+h = 6.62607015e-34 #(J s) Planck constant
@@ -0,0 +1,128 @@
+"""
+Lightweight tracing of the sf3dmodels pipeline stages.
+
+The decorated stages (grid construction, property builders, submodel overlaps, writers, grid fillers) record their
+wall and CPU times, the growth of the peak resident memory, the bytes read and written by the process and the number
+of rows (cells) processed. Each record is written as one JSON line into the trace file.
+
+Tracing is off by default, and a disabled stage costs a single flag check. Enable it with the environment variable
+SF3D_TRACE=<trace file> or with `enable`:
+
+>>> from sf3dmodels.utils import trace
+>>> trace.enable('sf3d_trace.jsonl')
+"""
+from __future__ import print_function
+import os
+import sys
+import json
+import time
+import threading
+import functools
+
+try: import resource
+except ImportError: resource = None #Not available on Windows
+
+try: _cpu_time = time.process_time
+except AttributeError: _cpu_time = lambda: sum(os.times()[:2]) #Python < 3.3: user + system time of the process
+
+__all__ = ['enable', 'disable', 'stage', 'add_rows']
+
+class _State(object):
+    enabled = False
+    file = None
+    local = threading.local()
+    lock = threading.Lock()
+
+_state = _State()
+
+def enable(file='sf3d_trace.jsonl'):
+    """
+    Starts tracing the pipeline stages into ``file`` (JSON lines, appended).
+    """
+    disable()
+    _state.file = open(file, 'a')
+    _state.enabled = True
+
+def disable():
+    """
+    Stops tracing and closes the trace file.
+    """
+    _state.enabled = False
+    if _state.file is not None: _state.file.close()
+    _state.file = None
+
+def _io_bytes():
+    #Characters read and written by the process, including those served by the page cache
+    try:
+        with open('/proc/self/io', 'r') as f: io = dict(line.split(':') for line in f)
+        return int(io['rchar']), int(io['wchar'])
+    except (IOError, OSError, KeyError, ValueError): return None, None
+
+def _max_rss():
+    #Peak resident set size, in kB
+    if resource is None: return None
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return rss // 1024 if sys.platform == 'darwin' else rss #bytes on macOS
+
+def _stack():
+    if not hasattr(_state.local, 'stack'): _state.local.stack = []
+    return _state.local.stack
+
+def add_rows(n):
+    """
+    Adds ``n`` to the rows processed by the innermost running stage. Does nothing if tracing is disabled.
+    """
+    if _state.enabled and _stack(): _stack()[-1]['rows'] += int(n)
+
+def _guess_rows(args, kwargs, result):
+    #Number of cells of the returned grid, or of the (self.)GRID argument, 
+    #else the length of the returned array or of the first array held by the returned object (e.g. velocity_random)
+    for obj in [result] + list(args) + list(kwargs.values()):
+        npoints = getattr(getattr(obj, 'GRID', obj), 'NPoints', None)
+        if npoints is None: continue
+        try: return int(npoints)
+        except (TypeError, ValueError): pass
+    for val in [result] + list(getattr(result, '__dict__', {}).values()):
+        if hasattr(val, 'shape') and len(val.shape): return int(val.shape[-1])
+    return None
+
+def stage(func=None, name=None):
+    """
+    Decorator tracing each call of ``func`` as a pipeline stage.
+
+    Parameters
+    ----------
+    name : str, optional
+       Stage name in the trace. Defaults to the qualified name of ``func``.
+    """
+    if func is None: return lambda func: stage(func, name=name)
+    tag = name or '%s.%s'%(func.__module__.split('sf3dmodels.')[-1], getattr(func, '__qualname__', func.__name__))
+
+    @functools.wraps(func)
+    def wrapper(*args, **kwargs):
+        if not _state.enabled: return func(*args, **kwargs)
+        stack = _stack()
+        record = {'stage': tag, 'parent': stack[-1]['stage'] if stack else None, 'depth': len(stack), 'rows': 0}
+        stack.append(record)
+        rss0, (read0, write0) = _max_rss(), _io_bytes()
+        wall0, cpu0 = time.time(), _cpu_time()
+        try:
+            result = func(*args, **kwargs)
+        finally:
+            stack.pop()
+        record['wall'] = time.time() - wall0
+        record['cpu'] = _cpu_time() - cpu0
+        rss1, (read1, write1) = _max_rss(), _io_bytes()
+        record['start'] = wall0
+        record['max_rss_delta_kb'] = rss1 - rss0 if rss0 is not None else None
+        record['bytes_read'] = read1 - read0 if read0 is not None else None
+        record['bytes_written'] = write1 - write0 if write0 is not None else None
+        if record['rows'] == 0: record['rows'] = _guess_rows(args, kwargs, result)
+        with _state.lock:
+            if _state.file is not None:
+                _state.file.write(json.dumps(record) + '\n')
+                _state.file.flush()
+        return result
+    return wrapper
+
+if os.environ.get('SF3D_TRACE'): enable(os.environ['SF3D_TRACE'])